@@ -4,8 +4,16 @@
  * @date July 12, 2015
  * @brief Implementation of a* search for a Bucharest map (see data.png). 
  * book. Start state: Arad. Goal state: Bucharest.
+ * Compile with -std=c++11 -pthread.
+ * Usage: ./a.out                                          (Romania map in data.txt)
+ *        ./a.out -b <graph.bin> <start> <goal>           (binary edge list, see graph.h)
+ *        ./a.out -q <#queries> [<graph.bin> [<#landmarks>]]  (heuristic benchmark)
+ *        ./a.out -m <queries.txt> <#threads> [<graph.bin>]  (batch of "start goal" lines)
+ *        ./a.out -g <rows> <cols> <graph.bin>            (writes a random grid road network)
+ * A trailing -alt or -bidir switches the searches to ALT landmarks / bidirectional ALT.
  */
 
+#include <algorithm>
 #include <assert.h>
 #include <fstream>
 #include <iostream>
@@ -15,163 +23,467 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/time.h>
 #include <vector>
 #include <queue>
+#include <atomic>
+#include <thread>
+#include "graph.h"
+#include "heap.h"
 
 using namespace std;
 
+Graph graph;										///< Road map in CSR form
+bool verbose = true;							///< Prints every expansion (only for small maps)
+
 /* ******************************************************************************************** */
-struct State {
-	string name;
-	set <State*> neighs;
-	map <State*, double> neighDists;
-	double totalEstimatedCost;			// f
-	double costFromStart;						// g
-	double euclideanDist; 					// h
-	State* prev;
+/// The state of a search in one direction: tentative costs, parents, open list and closed set.
+/// The entries of a node are only valid if its stamp matches the current generation, so that a
+/// new query resets the search in O(1) instead of clearing arrays over the whole graph.
+struct Search {
+
+	vector <double> g;						///< Cost from the root of this search
+	vector <int> parent;					///< Parent of each node on its best known path
+	vector <unsigned> seen;				///< Generation in which g/parent were last written
+	vector <unsigned> closed;			///< Generation in which the node was expanded
+	IndexedHeap <4> open;					///< Open list keyed by g + potential
+	unsigned gen;									///< Current generation, always > 0
+
+	void init (int n) {
+		g.assign(n, INFINITY);
+		parent.assign(n, -1);
+		seen.assign(n, 0);
+		closed.assign(n, 0);
+		open = IndexedHeap <4> (n);
+		gen = 1;
+	}
+
+	/// Starts a new search; the stamps are only cleared when the generation counter wraps around
+	void reset () {
+		open.clear();
+		if(++gen == 0) {
+			fill(seen.begin(), seen.end(), 0);
+			fill(closed.begin(), closed.end(), 0);
+			gen = 1;
+		}
+	}
+
+	inline double cost (int v) const { return (seen[v] == gen) ? g[v] : INFINITY; }
+	inline int prev (int v) const { return (seen[v] == gen) ? parent[v] : -1; }
+	inline bool isClosed (int v) const { return closed[v] == gen; }
+	inline void close (int v) { closed[v] = gen; }
+	inline void update (int v, double cost, int p) { g[v] = cost, parent[v] = p, seen[v] = gen; }
 };
 
-map <string, State> states;
+/// The mutable state of a query. Each thread owns one; the graph and landmarks are shared.
+struct Workspace {
+	Search forward, backward;
+	void init (int n) { forward.init(n), backward.init(n); }
+};
+
+/// A point-to-point query and its outcome
+struct Query {
+	int start, goal;
+	double cost;									///< Shortest path length, INFINITY if unreachable
+	int expanded;									///< Number of nodes expanded (both directions)
+	int meet;											///< Node where the two searches of a bidirectional query met
+	Query (int s, int g) : start(s), goal(g), cost(INFINITY), expanded(0), meet(-1) {}
+};
 
 /* ******************************************************************************************** */
-/// Comparison function for the priority queue
-class CompareState {
-  bool reverse;
-public:
-  CompareState (const bool& revparam=1) {reverse=revparam;}
-  bool operator() (State*& lhs, State*& rhs) const {
-    if (reverse) return (lhs->totalEstimatedCost>rhs->totalEstimatedCost);
-    else return (lhs->totalEstimatedCost<rhs->totalEstimatedCost);
-  }
+/// ALT (A*, Landmarks, Triangle inequality) preprocessing: exact distances from a few far apart
+/// landmarks give the lower bound d(v,t) >= |d(l,t) - d(l,v)| for any pair of nodes.
+struct Landmarks {
+
+	vector <int> ids;							///< Landmark nodes
+	vector <float> dist;					///< dist[v * k + l] is d(l,v); node-major so a bound is one line
+
+	int size () const { return ids.size(); }
+
+	/// Lower bound on the distance between v and t
+	inline double lowerBound (int v, int t) const {
+		int k = ids.size();
+		const float* dv = &dist[v * k], *dt = &dist[t * k];
+		float best = 0.0;
+		for(int l = 0; l < k; l++) best = max(best, fabsf(dt[l] - dv[l]));
+		return best;
+	}
 };
 
+Landmarks landmarks;
+
 /* ******************************************************************************************** */
-/// Parses the edge lengths and the Euclidean distances in the map data.png.
-void parseData () {
-
-	// Open the file
-	fstream file ("data.txt");
-	assert(file.is_open());
-
-	// First, read the edge lengths and create the map structure
-	char line [256];
-	char city1 [64], city2 [64], mapKey [256];
-	double dist;
-	for(size_t i = 0; i < 23; i++) {
-
-		// Get the city names
-		file.getline(line, 256);	
-		sscanf(line, "%s %s %lf", city1, city2, &dist);
-
-		// Add the information for the first city
-		State& s1 = states[city1];
-		s1.neighs.insert(&(states[city2]));
-		s1.neighDists[(&(states[city2]))] = dist;
-		s1.name = string(city1);
-
-		// Add the information for the second city
-		State& s2 = states[city2];
-		s2.neighs.insert(&(states[city1]));
-		s2.neighDists[(&(states[city1]))] = dist;
-		s2.name = string(city2);
-	}
-	
-	// Second, read the Euclidean distances
-	file.getline(line, 256);	
-	for(int i = 0; i < 20; i++) {
-
-		// Get the city name and distance
-		file.getline(line, 256);	
-		sscanf(line, "%s %lf", city1, &dist);
-
-		// Set the distance
-		states[city1].euclideanDist = dist;
+/// Computes the distances from the source to every node with Dijkstra's algorithm
+void dijkstra (int source, Search& search) {
+
+	search.reset();
+	search.update(source, 0.0, -1);
+	search.open.push(source, 0.0);
+	while(!search.open.empty()) {
+		int current = search.open.pop();
+		search.close(current);
+		for(int e = graph.offsets[current]; e < graph.offsets[current+1]; e++) {
+			int neigh = graph.targets[e];
+			double cost = search.g[current] + graph.weights[e];
+			if(search.isClosed(neigh) || cost >= search.cost(neigh)) continue;
+			if(search.open.contains(neigh)) search.open.decreaseKey(neigh, cost);
+			else search.open.push(neigh, cost);
+			search.update(neigh, cost, current);
+		}
 	}
 }
 
 /* ******************************************************************************************** */
-/// Regenerates path from the search 
-void printPath() {
+/// Picks k landmarks with the farthest-point heuristic (each new landmark is the node farthest
+/// away from the ones chosen so far) and stores their distance tables.
+void selectLandmarks (int k, Workspace& ws) {
+
+	Search& search = ws.forward;
+	int n = graph.numNodes();
+	k = min(k, n);
+	landmarks.ids.clear();
+	landmarks.dist.assign((size_t) n * k, 0.0);
+	vector <double> closest (n, INFINITY);
+	int next = rand() % n;
+	for(int l = 0; l < k; l++) {
 
-	State* prev = &(states["Bucharest"]);
-	printf("\nPath! Cost: %lf\n", prev->totalEstimatedCost);
-	while(prev != NULL) {
-		printf("%s\n", prev->name.c_str());
-		prev = prev->prev;
+		// The first run from a random node only serves to find a node on the periphery
+		dijkstra(next, search);
+		if(l == 0) {
+			int far = next;
+			for(int v = 0; v < n; v++)
+				if(search.cost(v) < INFINITY && search.cost(v) > search.cost(far)) far = v;
+			dijkstra(far, search);
+			next = far;
+		}
+
+		// Record the table and pick the node farthest from all the landmarks as the next one
+		landmarks.ids.push_back(next);
+		for(int v = 0; v < n; v++) {
+			landmarks.dist[(size_t) v * k + l] = search.cost(v);
+			closest[v] = min(closest[v], search.cost(v));
+		}
+		for(int v = 0; v < n; v++)
+			if(closest[v] < INFINITY && closest[v] > closest[next]) next = v;
 	}
 }
 
 /* ******************************************************************************************** */
-/// Implementation of A*
-bool astar () {
-
-	// Create the data structures to keep track of the search
-	set <State*> visited;
-	set <State*> in_queue;
-	priority_queue <State*, vector <State*>, CompareState> queue;
-	
+enum Heuristic { EUCLIDEAN, LANDMARKS };
+
+/// The straight-line distances of data.txt are only valid towards Bucharest (heuristicGoal); for
+/// other goals and graphs without them the "euclidean" heuristic degrades to zero (Dijkstra),
+/// which keeps it admissible.
+inline double estimate (Heuristic heur, int v, int goal) {
+	if(heur == LANDMARKS) return landmarks.lowerBound(v, goal);
+	return (goal == graph.heuristicGoal) ? graph.heuristic[v] : 0.0;
+}
+
+/* ******************************************************************************************** */
+/// Regenerates path from the search: the forward tree up to the meeting node (the goal in a
+/// unidirectional search) and the backward tree from there to the goal.
+void printPath (const Query& q, const Workspace& ws) {
+
+	printf("\nPath! Cost: %lf\n", q.cost);
+	vector <int> path;
+	for(int curr = q.meet; curr != -1; curr = ws.forward.prev(curr)) path.push_back(curr);
+	reverse(path.begin(), path.end());
+	if(q.meet != q.goal)
+		for(int curr = ws.backward.prev(q.meet); curr != -1; curr = ws.backward.prev(curr))
+			path.push_back(curr);
+	for(int i = path.size() - 1; i >= 0; i--) printf("%s\n", graph.name(path[i]).c_str());
+}
+
+/* ******************************************************************************************** */
+/// Implementation of A* on the CSR graph
+bool astar (Query& q, Workspace& ws, Heuristic heur = EUCLIDEAN) {
+
+	// Reset the search: the open list is a 4-ary indexed heap and the closed set a stamp array
+	Search& s = ws.forward;
+	s.reset();
+	const int* offsets = &graph.offsets[0];
+	const int* targets = &graph.targets[0];
+	const float* weights = &graph.weights[0];
+
 	// Initialize data for the start state
-	states["Arad"].costFromStart = 0.0;
-	states["Arad"].totalEstimatedCost = 0.0 + states["Arad"].euclideanDist;
-	queue.push(&states["Arad"]);
-	in_queue.insert(&states["Arad"]);
-	
+	s.update(q.start, 0.0, -1);
+	s.open.push(q.start, 0.0 + estimate(heur, q.start, q.goal));
+
 	// Start the search
-	while(!queue.empty()) {
+	while(!s.open.empty()) {
 
 		// Check if the top of the queue is the goal
-		State* current = queue.top();
-		printf("Expanding: '%s'\n", current->name.c_str());
-		if(current->name.compare("Bucharest") == 0) {
-			printPath();
+		int current = s.open.pop();
+		q.expanded++;
+		if(verbose) printf("Expanding: '%s'\n", graph.name(current).c_str());
+		if(current == q.goal) {
+			q.cost = s.g[current];
+			q.meet = current;
+			if(verbose) printPath(q, ws);
 			return true;
 		}
 
 		// Note that the state is seen
-		queue.pop();
-		in_queue.erase(in_queue.find(current));
-		visited.insert(current);
+		s.close(current);
 
 		// Expand the search to the neighbors
-		for(set <State*>::iterator n_it = current->neighs.begin(); n_it != current->neighs.end(); 
-				n_it++) {
-		
+		for(int e = offsets[current]; e < offsets[current+1]; e++) {
+
 			// Skip if the neighbor is visited before. Assumes consistent heuristic!
-			State* neigh = *n_it;
-			if(visited.find(neigh) != visited.end()) continue;
+			int neigh = targets[e];
+			if(s.isClosed(neigh)) continue;
 
-			// Estimate the possible shortest cost
-			double estCostFromStart = current->costFromStart + current->neighDists[neigh];
-			
 			// If the neighbor is not seen before or the cost can be decreased, update its standing
-			if((in_queue.find(neigh) == in_queue.end()) || (estCostFromStart < neigh->costFromStart)) {
-
-				// Update the neighbor information
-				neigh->prev = current;
-				neigh->costFromStart = estCostFromStart;
-				neigh->totalEstimatedCost = neigh->costFromStart + neigh->euclideanDist;
-				printf("\tneigh '%s' -> total cost: %lf\n", neigh->name.c_str(), neigh->totalEstimatedCost);
-				
-				// Add the neighbor to the queue (if already not there)
-				if(in_queue.find(neigh) == in_queue.end()) {
-					queue.push(neigh);
-					in_queue.insert(neigh);
-				}
-	
+			double estCostFromStart = s.g[current] + weights[e];
+			if(estCostFromStart >= s.cost(neigh)) continue;
+			s.update(neigh, estCostFromStart, current);
+			double totalEstimatedCost = estCostFromStart + estimate(heur, neigh, q.goal);
+			if(verbose)
+				printf("\tneigh '%s' -> total cost: %lf\n", graph.name(neigh).c_str(), totalEstimatedCost);
+
+			// Add the neighbor to the queue or move it up within the heap
+			if(s.open.contains(neigh)) s.open.decreaseKey(neigh, totalEstimatedCost);
+			else s.open.push(neigh, totalEstimatedCost);
+		}
+	}
+
+	if(verbose) printf("Failed.\n");
+	return false;
+}
+
+/* ******************************************************************************************** */
+/// Average ALT potential of the forward search; the backward search uses its negation
+inline double potential (const Query& q, int v) {
+	return 0.5 * (landmarks.lowerBound(v, q.goal) - landmarks.lowerBound(q.start, v));
+}
+
+/* ******************************************************************************************** */
+/// Bidirectional A* with the ALT bounds. Both searches use the average potential
+/// p(v) = (d(v,goal) - d(start,v)) / 2 (negated backwards) so that they see the same reduced
+/// edge costs; then the search can stop as soon as the two top keys add up to the best path
+/// found through a node reached from both sides.
+bool bidirectional (Query& q, Workspace& ws) {
+
+	Search& forward = ws.forward, &backward = ws.backward;
+	forward.reset();
+	backward.reset();
+	const int* offsets = &graph.offsets[0];
+	const int* targets = &graph.targets[0];
+	const float* weights = &graph.weights[0];
+
+	// Seed both directions
+	forward.update(q.start, 0.0, -1);
+	forward.open.push(q.start, potential(q, q.start));
+	backward.update(q.goal, 0.0, -1);
+	backward.open.push(q.goal, -potential(q, q.goal));
+	if(q.start == q.goal) q.cost = 0.0, q.meet = q.start;
+
+	while(!forward.open.empty() && !backward.open.empty()) {
+
+		// Stop when no path through an unexpanded node can beat the best one found
+		if(forward.open.topKey() + backward.open.topKey() >= q.cost) break;
+
+		// Expand the direction with the smaller key
+		bool isForward = (forward.open.topKey() <= backward.open.topKey());
+		Search& s = isForward ? forward : backward;
+		Search& other = isForward ? backward : forward;
+		double sign = isForward ? 1.0 : -1.0;
+		int current = s.open.pop();
+		s.close(current);
+		q.expanded++;
+		if(verbose) printf("Expanding (%s): '%s'\n", isForward ? "fwd" : "bwd", graph.name(current).c_str());
+
+		for(int e = offsets[current]; e < offsets[current+1]; e++) {
+			int neigh = targets[e];
+			if(s.isClosed(neigh)) continue;
+			double cost = s.g[current] + weights[e];
+			if(cost >= s.cost(neigh)) continue;
+			s.update(neigh, cost, current);
+			double key = cost + sign * potential(q, neigh);
+			if(s.open.contains(neigh)) s.open.decreaseKey(neigh, key);
+			else s.open.push(neigh, key);
+
+			// Update the best path if the other side has reached the neighbor
+			if(cost + other.cost(neigh) < q.cost) {
+				q.cost = cost + other.cost(neigh);
+				q.meet = neigh;
 			}
 		}
 	}
 
-	printf("Failed.\n");
+	if(q.meet == -1) {
+		if(verbose) printf("Failed.\n");
+		return false;
+	}
+	if(verbose) printPath(q, ws);
+	return true;
+}
+
+/* ******************************************************************************************** */
+double now () {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
+
+/* ******************************************************************************************** */
+enum Method { PLAIN, ALT, ALT_BIDIR };
+
+/// Solves a query with the given method
+inline bool solve (Query& q, Workspace& ws, Method method) {
+	if(method == PLAIN) return astar(q, ws, EUCLIDEAN);
+	else if(method == ALT) return astar(q, ws, LANDMARKS);
+	else return bidirectional(q, ws);
+}
+
+/* ******************************************************************************************** */
+/// Compares the expanded nodes and latencies of A* with the Euclidean heuristic (or Dijkstra
+/// if the graph has none), A* with ALT and bidirectional A* with ALT over random queries. The
+/// Romania map only has straight-line distances to Bucharest, so half of the goals are Bucharest
+/// there and the other half are random (where the first method runs as Dijkstra).
+void benchmark (int numQueries, int numLandmarks, Workspace& ws) {
+
+	// Preprocess
+	double t0 = now();
+	selectLandmarks(numLandmarks, ws);
+	printf("Selected %d landmarks in %.3lf s\n", landmarks.size(), now() - t0);
+
+	// Create the queries
+	int n = graph.numNodes();
+	vector <Query> queries;
+	for(int i = 0; i < numQueries; i++) {
+		int goal = rand() % n;
+		if((graph.heuristicGoal != -1) && (i % 2 == 0)) goal = graph.heuristicGoal;
+		queries.push_back(Query(rand() % n, goal));
+	}
+
+	// Run each method on the same queries
+	const char* names [] = {graph.heuristic.empty() ? "dijkstra" : "euclidean", "alt", "alt-bidir"};
+	vector <double> costs;
+	for(int method = PLAIN; method <= ALT_BIDIR; method++) {
+		long expanded = 0;
+		int mismatches = 0;
+		double t1 = now();
+		for(int i = 0; i < numQueries; i++) {
+			Query q = queries[i];
+			solve(q, ws, (Method) method);
+			expanded += q.expanded;
+			if(method == PLAIN) costs.push_back(q.cost);
+			else if(fabs(q.cost - costs[i]) > 1e-4 * max(1.0, costs[i])) mismatches++;
+		}
+		double elapsed = now() - t1;
+		printf("%-10s: %10.1lf expanded/query, %10.1lf us/query, %d cost mismatches\n", names[method],
+			((double) expanded) / numQueries, 1e6 * elapsed / numQueries, mismatches);
+	}
+}
+
+/* ******************************************************************************************** */
+/// Reads "start goal" pairs from the file and solves them on a pool of threads. Each thread
+/// owns a workspace and pulls the next query index from a shared counter.
+void batch (const char* fileName, int numThreads, Method method) {
+
+	// Read the queries
+	vector <Query> queries;
+	ifstream file (fileName);
+	assert(file.is_open() && "Could not open the query file");
+	string start, goal;
+	while(file >> start >> goal) {
+		int s = graph.id(start.c_str()), g = graph.id(goal.c_str());
+		assert((s != -1) && (g != -1) && "Unknown start or goal");
+		queries.push_back(Query(s, g));
+	}
+
+	// Solve them in parallel
+	vector <Workspace> workspaces (numThreads);
+	for(int t = 0; t < numThreads; t++) workspaces[t].init(graph.numNodes());
+	atomic <int> next (0);
+	double t0 = now();
+	vector <thread> threads;
+	for(int t = 0; t < numThreads; t++) {
+		threads.push_back(thread([&, t] () {
+			for(int i = next++; i < (int) queries.size(); i = next++) 
+				solve(queries[i], workspaces[t], method);
+		}));
+	}
+	for(int t = 0; t < numThreads; t++) threads[t].join();
+	double elapsed = now() - t0;
+
+	// Report the results
+	long expanded = 0;
+	for(size_t i = 0; i < queries.size(); i++) {
+		printf("%s %s %lf\n", graph.name(queries[i].start).c_str(), graph.name(queries[i].goal).c_str(),
+			queries[i].cost);
+		expanded += queries[i].expanded;
+	}
+	printf("%lu queries on %d threads in %.3lf s: %.1lf queries/sec, %.1lf expanded/query\n", 
+		queries.size(), numThreads, elapsed, queries.size() / elapsed, 
+		((double) expanded) / queries.size());
 }
 
 /* ******************************************************************************************** */
 int main (int argc, char* argv[]) {
 
-	// Get the data for the problem
-	parseData();
+	// Generate a grid road network: -g <rows> <cols> <file>
+	if((argc > 4) && (strcmp(argv[1], "-g") == 0)) {
+		vector <Edge> edges;
+		int rows = atoi(argv[2]), cols = atoi(argv[3]);
+		makeGrid(rows, cols, edges);
+		bool saved = saveBinary(argv[4], rows * cols, edges);
+		assert(saved && "Could not write the graph");
+		printf("Wrote %d nodes, %lu edges to '%s'\n", rows * cols, edges.size(), argv[4]);
+		return 0;
+	}
+
+	// The heuristic can be chosen with a trailing -alt or -bidir in any mode
+	Method method = PLAIN;
+	if(strcmp(argv[argc-1], "-alt") == 0) method = ALT, argc--;
+	else if(strcmp(argv[argc-1], "-bidir") == 0) method = ALT_BIDIR, argc--;
+
+	// Get the data for the problem: either the Romania map or a binary edge list with the ids
+	// of the start and goal nodes (-b <file> <start> <goal>), the benchmark (-q) or the batch 
+	// mode (-m) on either
+	const char* startName = "Arad", *goalName = "Bucharest";
+	char mode = 0;
+	bool loaded;
+	if((argc > 4) && (strcmp(argv[1], "-b") == 0)) {
+		loaded = loadBinary(graph, argv[2]);
+		startName = argv[3], goalName = argv[4];
+		verbose = false;
+	}
+	else if((argc > 2) && (strcmp(argv[1], "-q") == 0)) {
+		loaded = (argc > 3) ? loadBinary(graph, argv[3]) : loadText(graph, "data.txt");
+		mode = 'q';
+		verbose = false;
+	}
+	else if((argc > 3) && (strcmp(argv[1], "-m") == 0)) {
+		loaded = (argc > 4) ? loadBinary(graph, argv[4]) : loadText(graph, "data.txt");
+		mode = 'm';
+		verbose = false;
+	}
+	else loaded = loadText(graph, "data.txt");
+	assert(loaded && "Could not read the graph");
+	Workspace ws;
+	ws.init(graph.numNodes());
+
+	// Benchmark the heuristics
+	srand(time(NULL));
+	if(mode == 'q') {
+		benchmark(atoi(argv[2]), (argc > 4) ? atoi(argv[4]) : 16, ws);
+		return 0;
+	}
+
+	// Solve the batch of queries
+	if(method != PLAIN) selectLandmarks(16, ws);
+	if(mode == 'm') {
+		batch(argv[2], atoi(argv[3]), method);
+		return 0;
+	}
 
 	// Search
-	astar();
+	int start = graph.id(startName), goal = graph.id(goalName);
+	assert((start != -1) && (goal != -1) && "Unknown start or goal");
+	Query q (start, goal);
+	solve(q, ws, method);
+	if(!verbose) printf("Cost: %lf, expanded: %d\n", q.cost, q.expanded);
 }
 /* ******************************************************************************************** */
@@ -0,0 +1,193 @@
+/**
+ * @file graph.h
+ * @author Can Erdogan
+ * @date July 12, 2015
+ * @brief Compressed sparse row (CSR) graph for the search algorithms. City names are interned
+ * once at load time so that the searches only work with dense integer ids: the edges of node i
+ * are targets/weights[offsets[i] .. offsets[i+1]). Graphs are undirected; every input edge is
+ * stored in both directions.
+ */
+
+#include <assert.h>
+#include <fstream>
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+/* ******************************************************************************************** */
+struct Edge {
+	int from, to;
+	float weight;
+	Edge () {}
+	Edge (int f, int t, float w) : from(f), to(t), weight(w) {}
+};
+
+/* ******************************************************************************************** */
+struct Graph {
+
+	std::vector <int> offsets;							///< Size n+1, start of the edges of each node
+	std::vector <int> targets;							///< Neighbor ids, grouped by source node
+	std::vector <float> weights;						///< Edge lengths, parallel to targets
+	std::vector <double> heuristic;					///< Optional straight-line distances to the goal
+	int heuristicGoal;											///< The node the heuristic is towards, -1 if none
+	std::vector <std::string> names;				///< Optional node names (text inputs only)
+	std::map <std::string, int> ids;				///< Name to id, only used while parsing queries
+
+	Graph () : heuristicGoal(-1) {}
+
+	int numNodes () const { return offsets.size() - 1; }
+	int numEdges () const { return targets.size(); }
+
+	/// Returns the name of the node, or its id if the graph has no names
+	std::string name (int id) const {
+		if(!names.empty()) return names[id];
+		char buf [16];
+		sprintf(buf, "%d", id);
+		return buf;
+	}
+
+	/// Returns the id of a node given by name (or by number for unnamed graphs), -1 if unknown
+	int id (const char* name) const {
+		if(names.empty()) {
+			int id = atoi(name);
+			return (id >= 0 && id < numNodes()) ? id : -1;
+		}
+		std::map <std::string, int>::const_iterator it = ids.find(name);
+		return (it == ids.end()) ? -1 : it->second;
+	}
+
+	/// Returns the id of the name, creating a new node if it is seen for the first time
+	int intern (const char* name) {
+		std::map <std::string, int>::iterator it = ids.find(name);
+		if(it != ids.end()) return it->second;
+		int id = names.size();
+		ids[name] = id;
+		names.push_back(name);
+		return id;
+	}
+
+	/// Returns the index of the edge u -> v in targets/weights, -1 if there is none
+	int findEdge (int u, int v) const {
+		for(int e = offsets[u]; e < offsets[u+1]; e++) if(targets[e] == v) return e;
+		return -1;
+	}
+
+	/// Changes the length of the undirected edge (u,v), i.e. of both of its directions
+	void setWeight (int u, int v, float w) {
+		int uv = findEdge(u, v), vu = findEdge(v, u);
+		assert((uv != -1) && (vu != -1));
+		weights[uv] = weights[vu] = w;
+	}
+
+	/* ****************************************************************************************** */
+	/// Builds the CSR arrays from an undirected edge list with a counting sort on the sources
+	void build (int n, const std::vector <Edge>& edges) {
+		offsets.assign(n + 1, 0);
+		for(size_t i = 0; i < edges.size(); i++) {
+			offsets[edges[i].from + 1]++;
+			offsets[edges[i].to + 1]++;
+		}
+		for(int i = 0; i < n; i++) offsets[i+1] += offsets[i];
+		targets.resize(2 * edges.size());
+		weights.resize(2 * edges.size());
+		std::vector <int> next (offsets.begin(), offsets.end() - 1);
+		for(size_t i = 0; i < edges.size(); i++) {
+			const Edge& e = edges[i];
+			targets[next[e.from]] = e.to;
+			weights[next[e.from]++] = e.weight;
+			targets[next[e.to]] = e.from;
+			weights[next[e.to]++] = e.weight;
+		}
+	}
+};
+
+/* ******************************************************************************************** */
+/// Parses the text format of data.txt: "city1 city2 dist" edge lines, a dashed separator line
+/// and then optional "city dist" lines with the straight-line distances to the goal.
+bool loadText (Graph& graph, const char* fileName) {
+
+	// Open the file
+	std::fstream file (fileName);
+	if(!file.is_open()) return false;
+
+	// First, read the edge lengths and intern the city names
+	char line [256];
+	char city1 [64], city2 [64];
+	double dist;
+	std::vector <Edge> edges;
+	while(file.getline(line, 256)) {
+		if(line[0] == '-') break;
+		if(sscanf(line, "%63s %63s %lf", city1, city2, &dist) != 3) continue;
+		int id1 = graph.intern(city1);
+		int id2 = graph.intern(city2);
+		edges.push_back(Edge(id1, id2, dist));
+	}
+	graph.build(graph.names.size(), edges);
+
+	// Second, read the Euclidean distances
+	while(file.getline(line, 256)) {
+		if(sscanf(line, "%63s %lf", city1, &dist) != 2) continue;
+		int id = graph.id(city1);
+		if(id == -1) continue;
+		if(graph.heuristic.empty()) graph.heuristic.assign(graph.numNodes(), 0.0);
+		graph.heuristic[id] = dist;
+		if(dist == 0.0) graph.heuristicGoal = id;
+	}
+	return true;
+}
+
+/* ******************************************************************************************** */
+/// Reads a binary edge list: int32 #nodes, int64 #edges and then (int32 from, int32 to,
+/// float weight) for each undirected edge.
+bool loadBinary (Graph& graph, const char* fileName) {
+
+	FILE* file = fopen(fileName, "rb");
+	if(file == NULL) return false;
+	int32_t n;
+	int64_t m;
+	if(fread(&n, sizeof(n), 1, file) != 1 || fread(&m, sizeof(m), 1, file) != 1) {
+		fclose(file);
+		return false;
+	}
+
+	// Read the edges with a single call; Edge has the same 12 byte layout as the file records
+	assert(sizeof(Edge) == 12);
+	std::vector <Edge> edges (m);
+	bool ok = (m == 0) || (fread(&edges[0], sizeof(Edge), m, file) == (size_t) m);
+	fclose(file);
+	if(!ok) return false;
+	for(int64_t i = 0; i < m; i++) 
+		assert(edges[i].from >= 0 && edges[i].from < n && edges[i].to >= 0 && edges[i].to < n);
+	graph.build(n, edges);
+	return true;
+}
+
+/* ******************************************************************************************** */
+/// Writes an edge list in the format read by loadBinary
+bool saveBinary (const char* fileName, int n, const std::vector <Edge>& edges) {
+	FILE* file = fopen(fileName, "wb");
+	if(file == NULL) return false;
+	int32_t n_ = n;
+	int64_t m = edges.size();
+	fwrite(&n_, sizeof(n_), 1, file);
+	fwrite(&m, sizeof(m), 1, file);
+	if(m > 0) fwrite(&edges[0], sizeof(Edge), m, file);
+	fclose(file);
+	return true;
+}
+
+/* ******************************************************************************************** */
+/// Creates a rows x cols grid "road network" with 4-connectivity and random lengths in [1,2)
+void makeGrid (int rows, int cols, std::vector <Edge>& edges) {
+	edges.clear();
+	for(int r = 0; r < rows; r++) {
+		for(int c = 0; c < cols; c++) {
+			int id = r * cols + c;
+			if(c + 1 < cols) edges.push_back(Edge(id, id + 1, 1.0 + ((double) rand()) / RAND_MAX));
+			if(r + 1 < rows) edges.push_back(Edge(id, id + cols, 1.0 + ((double) rand()) / RAND_MAX));
+		}
+	}
+}
@@ -0,0 +1,138 @@
+/**
+ * @file heap.h
+ * @author Can Erdogan
+ * @date July 12, 2015
+ * @brief Indexed d-ary heap used as the open list of the graph searches (A*, D* Lite).
+ */
+
+#include <algorithm>
+#include <assert.h>
+#include <vector>
+
+/* ******************************************************************************************** */
+/// Indexed d-ary min-heap over dense node ids. The heap owns the keys so a node whose cost 
+/// improves is sifted up in place (decrease-key) instead of mutating a key under the heap.
+/// Keys only need operator<.
+template <int D, class Key = double>
+struct IndexedHeap {
+
+	std::vector <int> ids;				///< Node ids in heap order
+	std::vector <Key> keys;				///< Key of each heap slot, parallel to ids
+	std::vector <int> pos;				///< Heap slot of each node id, -1 if not in the heap
+
+	IndexedHeap (int n = 0) : pos(n, -1) {}
+
+	/// Empties the heap in O(heap size) rather than O(#nodes)
+	void clear () {
+		for(size_t i = 0; i < ids.size(); i++) pos[ids[i]] = -1;
+		ids.clear();
+		keys.clear();
+	}
+
+	bool empty () const { return ids.empty(); }
+	bool contains (int id) const { return pos[id] != -1; }
+	int top () const { return ids[0]; }
+	const Key& topKey () const { return keys[0]; }
+
+	/// Inserts a node that is not in the heap
+	void push (int id, const Key& key) {
+		assert(pos[id] == -1);
+		ids.push_back(id);
+		keys.push_back(key);
+		pos[id] = ids.size() - 1;
+		siftUp(ids.size() - 1);
+	}
+
+	/// Lowers the key of a node already in the heap
+	void decreaseKey (int id, const Key& key) {
+		int i = pos[id];
+		assert((i != -1) && !(keys[i] < key));
+		keys[i] = key;
+		siftUp(i);
+	}
+
+	/// Changes the key of a node already in the heap in either direction
+	void update (int id, const Key& key) {
+		int i = pos[id];
+		assert(i != -1);
+		bool up = key < keys[i];
+		keys[i] = key;
+		if(up) siftUp(i);
+		else siftDown(i);
+	}
+
+	/// Removes a node from anywhere in the heap by moving the last slot into its place
+	void remove (int id) {
+		int i = pos[id];
+		assert(i != -1);
+		pos[id] = -1;
+		int last = ids.size() - 1;
+		int moved = ids[last];
+		if(i != last) {
+			ids[i] = moved;
+			keys[i] = keys[last];
+			pos[moved] = i;
+		}
+		ids.pop_back();
+		keys.pop_back();
+		if(i < last) {
+			siftUp(i);
+			if(pos[moved] == i) siftDown(i);
+		}
+	}
+
+	/// Removes and returns the node with the minimum key
+	int pop () {
+		int id = ids[0];
+		pos[id] = -1;
+		int last = ids.size() - 1;
+		if(last > 0) {
+			ids[0] = ids[last];
+			keys[0] = keys[last];
+			pos[ids[0]] = 0;
+		}
+		ids.pop_back();
+		keys.pop_back();
+		if(last > 1) siftDown(0);
+		return id;
+	}
+
+	/// Moves the hole up until the parent is not larger; one write per level instead of swaps
+	void siftUp (int i) {
+		int id = ids[i];
+		Key key = keys[i];
+		while(i > 0) {
+			int parent = (i - 1) / D;
+			if(!(key < keys[parent])) break;
+			ids[i] = ids[parent];
+			keys[i] = keys[parent];
+			pos[ids[i]] = i;
+			i = parent;
+		}
+		ids[i] = id;
+		keys[i] = key;
+		pos[id] = i;
+	}
+
+	/// Moves the hole down to the smallest of the (up to) D children
+	void siftDown (int i) {
+		int n = ids.size();
+		int id = ids[i];
+		Key key = keys[i];
+		while(true) {
+			int first = D * i + 1;
+			if(first >= n) break;
+			int last = std::min(first + D, n), best = first;
+			for(int c = first + 1; c < last; c++) 
+				if(keys[c] < keys[best]) best = c;
+			if(!(keys[best] < key)) break;
+			ids[i] = ids[best];
+			keys[i] = keys[best];
+			pos[ids[i]] = i;
+			i = best;
+		}
+		ids[i] = id;
+		keys[i] = key;
+		pos[id] = i;
+	}
+};
@@ -3,25 +3,253 @@
  * @date 2015-08-07
  * @author Can Erdogan
  * @brief Implementation of the AVL trees.
+ * Usage: ./a.out              (reads "i <value>" and "r <value>" operations, draws the tree)
+ *        ./a.out -b <#keys>   (insert/search/remove benchmark against std::set)
+ *        ./a.out -l <#keys>   (bulk load vs. inserts, and split/join)
+ *        ./a.out -c <#keys> <#threads> <write %>  (concurrent lookups with 1..#threads threads)
+ * Compile with -std=c++11 -pthread.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
 #include <vector>
 #include <iostream>
+#include <set>
 #include <string>
 #include "avl.h"
+#include "concurrent_avl.h"
 
 using namespace std;
 
 /* ******************************************************************************************** */
-bool compare ( double x,  double y) { return x < y; }
+bool compare (const int& x, const int& y) { return x < y; }
 string print ( double x) { char buf[256]; sprintf(buf, "%.2f", x); return buf; }
 
 /* ******************************************************************************************** */
-int main () {
+/// Stops the benchmark if a result is wrong. Unlike assert it stays with -DNDEBUG, and since it
+/// consumes the results, the timed loops that produce them can not be optimized away.
+inline void check (bool ok, const char* what) {
+	if(ok) return;
+	fprintf(stderr, "Wrong result: %s\n", what);
+	exit(1);
+}
+
+/* ******************************************************************************************** */
+double now () {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
+
+/* ******************************************************************************************** */
+/// The operations of the benchmark on the AVL trees and std::set
+template <class Comp> inline void insertKey (AVL <int, Comp>& t, int x) { t.insert(x); }
+template <class Comp> inline bool searchKey (AVL <int, Comp>& t, int x) { return t.search(x) != NULL; }
+template <class Comp> inline void removeKey (AVL <int, Comp>& t, int x) { t.remove(x); }
+inline void insertKey (set <int>& t, int x) { t.insert(x); }
+inline bool searchKey (set <int>& t, int x) { return t.find(x) != t.end(); }
+inline void removeKey (set <int>& t, int x) { t.erase(x); }
+
+/* ******************************************************************************************** */
+/// Inserts, searches (half of them missing) and removes the keys, each in its own random order,
+/// and prints the nanoseconds per operation
+template <class Tree>
+void run (const char* name, Tree& tree, vector <int> keys) {
+
+	double t0 = now();
+	for(size_t i = 0; i < keys.size(); i++) insertKey(tree, keys[i]);
+	double t1 = now();
+	random_shuffle(keys.begin(), keys.end());
+	size_t found = 0;
+	for(size_t i = 0; i < keys.size(); i++) found += searchKey(tree, keys[i] + (i & 1));
+	double t2 = now();
+	random_shuffle(keys.begin(), keys.end());
+	for(size_t i = 0; i < keys.size(); i++) removeKey(tree, keys[i]);
+	double t3 = now();
+	check(found == (keys.size() + 1) / 2, "searches");
+
+	double n = keys.size();
+	printf("%-20s %10.1lf %10.1lf %10.1lf\n", name, 1e9 * (t1 - t0) / n, 1e9 * (t2 - t1) / n,
+		1e9 * (t3 - t2) / n);
+}
+
+/* ******************************************************************************************** */
+void benchmark (int n) {
+
+	// Even keys so that the odd ones can be searched for and missed
+	vector <int> keys (n);
+	for(int i = 0; i < n; i++) keys[i] = 2 * i;
+	random_shuffle(keys.begin(), keys.end());
+
+	printf("%d keys, ns per operation:\n%-20s %10s %10s %10s\n", n, "", "insert", "search", "remove");
+	AVL <int> avl;
+	run("AVL (std::less)", avl, keys);
+	AVL <int, bool (*) (const int&, const int&)> avlPointer (compare);
+	run("AVL (function ptr)", avlPointer, keys);
+	set <int> stdSet;
+	run("std::set", stdSet, keys);
+
+	// Order statistics on a full tree: the kth key is 2k
+	for(int i = 0; i < n; i++) avl.insert(keys[i]), stdSet.insert(keys[i]);
+	long rankSum = 0, selectSum = 0;
+	double r0 = now();
+	for(int i = 0; i < n; i++) rankSum += avl.rank(keys[i]);
+	double r1 = now();
+	for(int i = 0; i < n; i++) selectSum += avl.select(keys[i] / 2)->value;
+	double r2 = now();
+	check(rankSum == (long) n * (n - 1) / 2, "ranks");
+	check(selectSum == (long) n * (n - 1), "selects");
+	long visited = 0;
+	for(int i = 0; i < n; i += 100) {
+		for(AVL <int>::Range r = avl.range(keys[i], keys[i] + 200); !r.done(); r.advance()) visited++;
+	}
+	double r3 = now();
+	printf("rank: %.1lf ns, select: %.1lf ns, range of 100: %.1lf ns (%ld keys)\n", 1e9 * (r1 - r0) / n,
+		1e9 * (r2 - r1) / n, 1e9 * (r3 - r2) / ((n + 99) / 100), visited);
+
+	// Clearing full trees: the pool drops the AVL nodes at once
+	double t0 = now();
+	avl.clear();
+	double t1 = now();
+	stdSet.clear();
+	double t2 = now();
+	printf("clear: AVL %.3lf ms, std::set %.3lf ms\n", 1e3 * (t1 - t0), 1e3 * (t2 - t1));
+}
+
+/* ******************************************************************************************** */
+/// Builds a tree from sorted keys at once and with inserts (in order and shuffled), then splits
+/// it in the middle and joins the halves back
+void loadBenchmark (int n) {
+
+	vector <int> keys (n);
+	for(int i = 0; i < n; i++) keys[i] = 2 * i;
+	AVL <int> avl;
+
+	double t0 = now();
+	avl.build(keys.begin(), keys.end());
+	double t1 = now();
+	printf("build: %.3lf s, height %d\n", t1 - t0, avl.root->height);
+	avl.clear();
+
+	t0 = now();
+	for(int i = 0; i < n; i++) avl.insert(keys[i]);
+	t1 = now();
+	printf("sorted inserts: %.3lf s, height %d\n", t1 - t0, avl.root->height);
+	avl.clear();
 
-  AVL <double> avl (compare, print);
+	vector <int> shuffled (keys);
+	random_shuffle(shuffled.begin(), shuffled.end());
+	t0 = now();
+	for(int i = 0; i < n; i++) avl.insert(shuffled[i]);
+	t1 = now();
+	printf("shuffled inserts: %.3lf s, height %d\n", t1 - t0, avl.root->height);
+
+	// Cut at a few values and join back
+	const int numCuts = 1000;
+	double splitTime = 0.0, joinTime = 0.0;
+	long leftSizes = 0, expectedSizes = 0, joinedSizes = 0;
+	for(int i = 0; i < numCuts; i++) {
+		AVL <int> right;
+		int x = keys[rand() % n] + (i & 1);
+		expectedSizes += (x + 1) / 2;
+		t0 = now();
+		avl.split(x, right);
+		t1 = now();
+		leftSizes += avl.size();
+		double t2 = now();
+		avl.join(right);
+		splitTime += t1 - t0, joinTime += now() - t2;
+		joinedSizes += avl.size();
+	}
+	check(leftSizes == expectedSizes, "split sizes");
+	check(joinedSizes == (long) numCuts * n, "joined sizes");
+	printf("split: %.2lf us, join: %.2lf us\n", 1e6 * splitTime / numCuts, 1e6 * joinTime / numCuts);
+}
+
+/* ******************************************************************************************** */
+/// The tree with one lock around every operation, for comparison
+struct LockedAVL {
+	AVL <int> tree;
+	std::mutex lock;
+	void insert (int x) { std::lock_guard <std::mutex> l (lock); tree.insert(x); }
+	void remove (int x) { std::lock_guard <std::mutex> l (lock); tree.remove(x); }
+	bool contains (int x) { std::lock_guard <std::mutex> l (lock); return tree.search(x) != NULL; }
+};
+
+/* ******************************************************************************************** */
+/// Runs the threads on the tree for a second; each operation is a lookup of a key in the tree or,
+/// with the given percentage, an insert and a remove of a missing (odd) key. The lookups must all
+/// succeed while the writers rotate the tree. Returns the lookups per second.
+template <class Tree>
+double runMix (Tree& tree, int n, int numThreads, double writePercent) {
+	atomic <bool> stop (false);
+	atomic <long> lookups (0), hits (0);
+	vector <thread> threads;
+	for(int t = 0; t < numThreads; t++) {
+		threads.push_back(thread([&, t] () {
+			unsigned seed = t + 1;
+			long count = 0, found = 0;
+			while(!stop.load(memory_order_relaxed)) {
+				int x = 2 * (rand_r(&seed) % n);
+				if(rand_r(&seed) < writePercent / 100.0 * RAND_MAX) {
+					tree.insert(x + 1);
+					tree.remove(x + 1);
+				}
+				else {
+					found += tree.contains(x);
+					count++;
+				}
+			}
+			lookups += count, hits += found;
+		}));
+	}
+	double t0 = now();
+	this_thread::sleep_for(chrono::seconds(1));
+	stop = true;
+	for(int t = 0; t < numThreads; t++) threads[t].join();
+	double elapsed = now() - t0;
+	check(hits == lookups, "concurrent lookups");
+	return lookups / elapsed;
+}
+
+/* ******************************************************************************************** */
+void concurrentBenchmark (int n, int maxThreads, double writePercent) {
+
+	vector <int> keys (n);
+	for(int i = 0; i < n; i++) keys[i] = 2 * i;
+	ConcurrentAVL <int> optimistic;
+	optimistic.tree.build(keys.begin(), keys.end());
+	LockedAVL locked;
+	locked.tree.build(keys.begin(), keys.end());
+
+	printf("%d keys, %.2lf%% writes, lookups/s:\n%8s %14s %14s\n", n, writePercent, "#threads",
+		"seqlock", "mutex");
+	for(int t = 1; t <= maxThreads; t++) {
+		double a = runMix(optimistic, n, t, writePercent);
+		double b = runMix(locked, n, t, writePercent);
+		printf("%8d %14.0lf %14.0lf\n", t, a, b);
+	}
+}
+
+/* ******************************************************************************************** */
+int main (int argc, char* argv[]) {
+
+	if((argc > 2) && (strcmp(argv[1], "-b") == 0)) {
+		benchmark(atoi(argv[2]));
+		return 0;
+	}
+	if((argc > 4) && (strcmp(argv[1], "-c") == 0)) {
+		concurrentBenchmark(atoi(argv[2]), atoi(argv[3]), atof(argv[4]));
+		return 0;
+	}
+	if((argc > 2) && (strcmp(argv[1], "-l") == 0)) {
+		loadBenchmark(atoi(argv[2]));
+		return 0;
+	}
+
+  AVL <double> avl (less <double> (), print);
 	avl.insert(50);
 	avl.insert(30);
 	avl.insert(10);
@@ -32,8 +260,7 @@ int main () {
 		double x;
 		char c;
 		printf("New operation: \n");
-		cin >> c;
-		cin >> x;
+		if(!(cin >> c >> x)) break;
 		if(c == 'i') {
 			printf("Inserting: %lf\n", x);
 			avl.insert(x);
@@ -44,6 +271,8 @@ int main () {
 		}
 		avl.draw();
 	}
-	avl.traversal();
-
+	vector <AVL <double>::Node*> nodes;
+	avl.traversal(nodes);
+	for(size_t i = 0; i < nodes.size(); i++) printf("%s ", print(nodes[i]->value).c_str());
+	printf("\n");
 }
@@ -3,36 +3,186 @@
  * @date 2015-08-07
  * @author Can Erdogan
  * @brief Implementation of the AVL trees.
+ * The comparator is a type (std::less by default, or any functor with a bool operator() (const X&,
+ * const X&)) so that the comparisons are inlined on every step down the tree. The print function
+ * is only needed to draw the tree and for the debug output.
+ * The nodes come from a pool of contiguous slabs instead of one malloc each, so the nodes inserted
+ * together are close in memory and clearing the tree does not visit them one by one.
+ * Each node also counts the nodes of its subtree, which gives the rank of a value and the kth
+ * value in O(log n), and ranges are iterated lazily with the parent pointers.
+ * Sorted values are loaded in O(n) with build(), and trees are concatenated (join) and cut at a
+ * value (split) in O(log n). Trees that exchange nodes this way share their node pool.
+ * Inserts and removes walk down without recursion and stop rebalancing on the way up as soon as a
+ * subtree keeps its height. Compile with -DAVL_DEBUG=1 for the debug output and checks.
+ * With Balanced = false the rotations are off and the nodes stay where the inserts put them, for
+ * users that read the shape of the tree (the beach line of Voronoi_Diagrams/vd.cpp). Heights and
+ * sizes are still kept; build, join and split are only meant for balanced trees.
  */
 
+#pragma once
+
+#ifndef AVL_DEBUG
+#define AVL_DEBUG 0
+#endif
+
+#include <algorithm>
+#include <assert.h>
+#include <functional>
+#include <new>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <type_traits>
+#include <vector>
+
+/* ******************************************************************************************** */
+/// Allocates nodes in slabs of contiguous memory. Freed nodes go to a list threaded through their
+/// first word and are reused first. Resetting drops all the nodes at once but keeps the slabs.
+/// The slabs before the current one are full; the ones after it are spare.
+template <class Node>
+struct NodePool {
+
+	static const size_t slabSize = 4096;		///< Nodes per slab
+	std::vector <char*> slabs;
+	size_t slab;														///< Slab that the next nodes are taken from
+	size_t used;														///< Nodes handed out from that slab
+	void* freeList;
+	int refs;																///< Number of trees using the pool
+
+	NodePool () : slab(0), used(0), freeList(NULL), refs(1) {}
+	~NodePool () { for(size_t i = 0; i < slabs.size(); i++) free(slabs[i]); }
+
+	/// Returns memory for a node
+	inline void* alloc () {
+		if(freeList != NULL) {
+			void* p = freeList;
+			freeList = *(void**) p;
+			return p;
+		}
+		if(slab == slabs.size()) slabs.push_back((char*) malloc(sizeof(Node) * slabSize));
+		void* p = slabs[slab] + sizeof(Node) * used;
+		if(++used == slabSize) slab++, used = 0;
+		return p;
+	}
+
+	/// The list pointer overwrites the left link of the node, which lock-free readers may still load
+	inline void release (void* p) {
+		__atomic_store_n((void**) p, freeList, __ATOMIC_RELAXED);
+		freeList = p;
+	}
+
+	void reset () {
+		slab = used = 0;
+		freeList = NULL;
+	}
+
+	/// Takes over the slabs of the other pool, whose nodes stay where they are. They count as
+	/// full until the next reset, so the other pool's free nodes are not reused before that.
+	void adopt (NodePool& other) {
+		slabs.insert(slabs.begin(), other.slabs.begin(), other.slabs.end());
+		slab += other.slabs.size();
+		other.slabs.clear();
+		other.reset();
+	}
+
+private:
+	NodePool (const NodePool&);
+	NodePool& operator= (const NodePool&);
+};
 
 /* ******************************************************************************************** */
-template <class X>
+template <class X, class Comp = std::less <X>, bool Balanced = true>
 struct AVL {
 
-	bool dbg;
-  bool (*comp) (X,X);					///< Comparison function for the tree
-  std::string (*toStr) (X);				///< Print function for the tree values
-  AVL (bool (*comp_) (X , X), std::string (*print_) (X)) {	///< Constructor
+	static const bool dbg = AVL_DEBUG;	///< Debug output and checks, compiled out unless AVL_DEBUG
+  Comp comp;											///< Comparison functor for the tree
+  std::string (*toStr) (X);				///< Print function for the tree values, can be NULL
+  AVL (const Comp& comp_ = Comp(), std::string (*print_) (X) = NULL) {	///< Constructor
     comp = comp_;
     toStr = print_;
-		root = NULL;
-		dbg = 0;
+		setLink(root, NULL);
+		pool = new NodePool <Node> ();
   }
 
+	/// Returns the printed value, or "?" if there is no print function
+	std::string str (const X& x) const { return (toStr != NULL) ? toStr(x) : std::string("?"); }
+
   struct Node {								///< Node representation
 		Node* left, *right;
     Node* parent;
     X value;
 		int height;
-		Node (const X& v, Node* p) : value(v), parent(p), height(1), left(NULL), right(NULL) {}
+		int size;									///< Number of nodes in the subtree
+		Node (const X& v, Node* p, std::false_type) : parent(p), value(v), height(1), size(1) {
+			setLink(left, NULL), setLink(right, NULL);
+		}
+		Node (const X& v, Node* p, std::true_type) : parent(p), height(1), size(1) {
+			setLink(left, NULL), setLink(right, NULL);
+			X copy = v;
+			__atomic_store(&value, &copy, __ATOMIC_RELAXED);
+		}
   };  
 
+	/// The links and the values are written with atomic stores, so that the readers of
+	/// concurrent_avl.h can load them without the lock while a writer changes the tree. A release
+	/// store publishes a node together with its contents; on x86 both are plain moves.
+	static inline void setLink (Node*& link, Node* node) {
+		__atomic_store_n(&link, node, __ATOMIC_RELEASE);
+	}
+
+	/// Values that fit in a lock-free atomic word are stored atomically (see setLink), others copied
+	typedef std::integral_constant <bool, std::is_trivially_copyable <X>::value &&
+		(sizeof(X) <= sizeof(void*)) && ((sizeof(X) & (sizeof(X) - 1)) == 0)> AtomicValue;
+
+	static inline int count (const Node* n) { return (n != NULL) ? n->size : 0; }
+
 	Node* root;									///< Root of the tree
 	FILE* graphFile;
+	NodePool <Node>* pool;			///< Memory of the nodes, shared with the trees split from this one
+
+	~AVL () {
+		clear();
+		if(--pool->refs == 0) delete pool;
+	}
+
+	/* ****************************************************************************************** */
+	inline Node* allocNode (const X& x, Node* parent) {
+		return new (pool->alloc()) Node(x, parent, AtomicValue());
+	}
+
+	inline void freeNode (Node* node) {
+		node->~Node();
+		pool->release(node);
+	}
+
+	/// Switches the (empty) tree to the given pool
+	void usePool (NodePool <Node>* other) {
+		assert((root == NULL) && "Only an empty tree can change its pool");
+		if(other == pool) return;
+		if(--pool->refs == 0) delete pool;
+		pool = other;
+		pool->refs++;
+	}
+
+	/* ****************************************************************************************** */
+	/// Removes all the values. The nodes are only visited if the values need to be destroyed or
+	/// if the pool is shared with another tree.
+	void clear () {
+		if(root == NULL) return;
+		if(pool->refs > 1) destroy(root, true);
+		else {
+			if(!__has_trivial_destructor(X)) destroy(root, false);
+			pool->reset();
+		}
+		setLink(root, NULL);
+	}
+
+	void destroy (Node* curr, bool release) {
+		if(curr->left != NULL) destroy(curr->left, release);
+		if(curr->right != NULL) destroy(curr->right, release);
+		if(release) freeNode(curr);
+		else curr->~Node();
+	}
 
 	/* ****************************************************************************************** */
 	/// Returns the previous item in the binary search tree
@@ -102,6 +252,218 @@ struct AVL {
 		else return NULL;
 	}
 
+ 	/* ****************************************************************************************** */
+	/// Returns the number of values in the tree
+	int size () const { return count(root); }
+
+ 	/* ****************************************************************************************** */
+	/// Returns the number of values less than x
+	int rank (const X& x) const {
+		int r = 0;
+		for(Node* curr = root; curr != NULL; ) {
+			if(comp(curr->value, x)) {
+				r += count(curr->left) + 1;
+				curr = curr->right;
+			}
+			else curr = curr->left;
+		}
+		return r;
+	}
+
+ 	/* ****************************************************************************************** */
+	/// Returns the node with the kth smallest value (from 0), or NULL if k is out of range
+	Node* select (int k) const {
+		for(Node* curr = root; curr != NULL; ) {
+			int l = count(curr->left);
+			if(k < l) curr = curr->left;
+			else if(k == l) return curr;
+			else {
+				k -= l + 1;
+				curr = curr->right;
+			}
+		}
+		return NULL;
+	}
+
+ 	/* ****************************************************************************************** */
+	/// Returns the node with the smallest value not less than x, or NULL if there is none
+	Node* lowerBound (const X& x) const {
+		Node* best = NULL;
+		for(Node* curr = root; curr != NULL; ) {
+			if(comp(curr->value, x)) curr = curr->right;
+			else {
+				best = curr;
+				curr = curr->left;
+			}
+		}
+		return best;
+	}
+
+ 	/* ****************************************************************************************** */
+	/// Visits the values in [lo, hi) in order, one next() step at a time (amortized O(1)):
+	/// for(AVL<int>::Range r = avl.range(lo, hi); !r.done(); r.advance()) f(r.node->value);
+	struct Range {
+		AVL* tree;
+		Node* node;
+		X hi;
+		Range (AVL* t, Node* n, const X& h) : tree(t), node(n), hi(h) {}
+		bool done () const { return (node == NULL) || !tree->comp(node->value, hi); }
+		void advance () { node = tree->next(node); }
+	};
+
+	Range range (const X& lo, const X& hi) { return Range(this, lowerBound(lo), hi); }
+
+ 	/* ****************************************************************************************** */
+	/// Replaces the values with the sorted and distinct ones in [begin, end) in O(n): the middle
+	/// value is the root and each half is built the same way, so the tree is perfectly balanced.
+	template <class Iterator>
+	void build (Iterator begin, Iterator end) {
+		clear();
+		setLink(root, build(begin, end, NULL));
+	}
+
+	template <class Iterator>
+	Node* build (Iterator begin, Iterator end, Node* parent) {
+		if(begin == end) return NULL;
+		Iterator mid = begin + (end - begin) / 2;
+		Node* curr = allocNode(*mid, parent);
+		setLink(curr->left, build(begin, mid, curr));
+		setLink(curr->right, build(mid + 1, end, curr));
+		update(curr);
+		return curr;
+	}
+
+ 	/* ****************************************************************************************** */
+	/// Appends the values of the other tree, which must all be greater than the ones in this tree,
+	/// in O(log n); the other tree becomes empty. Its pool is taken over if it is not shared.
+	void join (AVL& other) {
+		if(other.root == NULL) return;
+		if(other.pool != pool) {
+			assert((other.pool->refs == 1) && "Joining trees that share another pool");
+			pool->adopt(*other.pool);
+			delete other.pool;
+			other.pool = pool;
+			pool->refs++;
+		}
+		if(root == NULL) setLink(root, other.root), setLink(other.root, NULL);
+		else {
+			Node* middle = other.unlinkMin();
+			setLink(root, join(root, middle, other.root));
+			root->parent = NULL;
+			setLink(other.root, NULL);
+		}
+	}
+
+ 	/* ****************************************************************************************** */
+	/// Moves the values not less than x to the other (empty) tree in O(log n)
+	void split (const X& x, AVL& other) {
+		other.usePool(pool);
+		Node* left, *right;
+		split(root, x, left, right);
+		setLink(root, left), setLink(other.root, right);
+		if(left != NULL) left->parent = NULL;
+		if(right != NULL) right->parent = NULL;
+	}
+
+ 	/* ****************************************************************************************** */
+	static inline int heightOf (const Node* n) { return (n != NULL) ? n->height : 0; }
+
+	static inline void update (Node* n) {
+		n->height = std::max(heightOf(n->left), heightOf(n->right)) + 1;
+		n->size = count(n->left) + count(n->right) + 1;
+	}
+
+	/// Rotations of a detached subtree: return its new root, whose parent the caller sets
+	Node* rotateLeft (Node* curr) {
+		Node* right = curr->right;
+		connect(right->left, curr, false);
+		connect(curr, right, true);
+		update(curr);
+		update(right);
+		return right;
+	}
+
+	Node* rotateRight (Node* curr) {
+		Node* left = curr->left;
+		connect(left->right, curr, true);
+		connect(curr, left, false);
+		update(curr);
+		update(left);
+		return left;
+	}
+
+	/// Restores the balance of a detached subtree whose children differ in height by at most 2
+	Node* rebalance (Node* curr) {
+		update(curr);
+		int balance = heightOf(curr->right) - heightOf(curr->left);
+		if(balance > 1) {
+			if(heightOf(curr->right->right) < heightOf(curr->right->left))
+				connect(rotateRight(curr->right), curr, false);
+			return rotateLeft(curr);
+		}
+		if(balance < -1) {
+			if(heightOf(curr->left->left) < heightOf(curr->left->right))
+				connect(rotateLeft(curr->left), curr, true);
+			return rotateRight(curr);
+		}
+		return curr;
+	}
+
+	/// Returns the root of a balanced tree of the left subtree, the middle node and the right
+	/// subtree (in this order). The middle node goes down the spine of the taller subtree to where
+	/// the heights meet, so the cost is the difference of the heights.
+	Node* join (Node* left, Node* middle, Node* right) {
+		if(heightOf(left) > heightOf(right) + 1) {
+			connect(join(left->right, middle, right), left, false);
+			return rebalance(left);
+		}
+		if(heightOf(right) > heightOf(left) + 1) {
+			connect(join(left, middle, right->left), right, true);
+			return rebalance(right);
+		}
+		connect(left, middle, true);
+		connect(right, middle, false);
+		update(middle);
+		return middle;
+	}
+
+	/// Splits the subtree into the values less than x and the rest: the nodes on the search path
+	/// for x are joined with the subtrees that hang off it on each side
+	void split (Node* curr, const X& x, Node*& left, Node*& right) {
+		if(curr == NULL) {
+			left = right = NULL;
+			return;
+		}
+		if(comp(curr->value, x)) {
+			Node* rightLeft;
+			split(curr->right, x, rightLeft, right);
+			left = join(curr->left, curr, rightLeft);
+		}
+		else {
+			Node* leftRight;
+			split(curr->left, x, left, leftRight);
+			right = join(leftRight, curr, curr->right);
+		}
+	}
+
+	/// Removes the node with the smallest value without freeing it
+	Node* unlinkMin () {
+		Node* curr = root;
+		while(curr->left != NULL) curr = curr->left;
+		Node* parent = curr->parent;
+		if(parent != NULL) {
+			connect(curr->right, parent, true);
+			retrace(parent, -1);
+		}
+		else {
+			setLink(root, curr->right);
+			if(root != NULL) root->parent = NULL;
+		}
+		setLink(curr->left, NULL), setLink(curr->right, NULL);
+		curr->parent = NULL;
+		return curr;
+	}
+
  	/* ****************************************************************************************** */
 	std::pair<bool,Node*> search_candidateLoc (const X& x) { 
 		if(root == NULL) return std::make_pair(false, (Node*)NULL);
@@ -112,7 +474,7 @@ struct AVL {
 	/// Returns the would-be parent node if the given data is added. Returns true if the exact
 	/// data is found.
   std::pair<bool,Node*> search_candidateLoc (const X& x, Node* curr) {
-		printf("%s: x: '%s', curr: '%s'\n", __FUNCTION__, print(x).c_str(), print(curr->value).c_str());
+		if(dbg) printf("%s: x: '%s', curr: '%s'\n", __FUNCTION__, str(x).c_str(), str(curr->value).c_str());
 		if(curr->left != NULL && comp(x, curr->value)) return search_candidateLoc(x, curr->left); 
 		else if(curr->right != NULL && comp(curr->value, x)) return search_candidateLoc(x, curr->right); 
 		else if(!comp(curr->value, x) && !comp(x, curr->value)) return std::make_pair(true,curr);
@@ -121,6 +483,7 @@ struct AVL {
 
  	/* ****************************************************************************************** */
 	void draw () { 
+		assert((toStr != NULL) && "Drawing needs a print function");
 		graphFile = fopen("graph.dot", "w+");
 		fprintf(graphFile, "digraph {\n");
   	fprintf(graphFile, "graph [ordering=\"out\"]\n");
@@ -184,87 +547,95 @@ struct AVL {
 	void rotateLeft (Node* curr, Node* right) {
 
 		if(dbg) 
-			printf("%s: %s, %s\n", __FUNCTION__, toStr(curr->value).c_str(), toStr(right->value).c_str());
+			printf("%s: %s, %s\n", __FUNCTION__, str(curr->value).c_str(), str(right->value).c_str());
 
 		// Make the connection between (current's parent,right)
 		right->parent = curr->parent;
 		if(curr->parent) {
-			if(curr->parent->left == curr) curr->parent->left = right;
-			else curr->parent->right = right;
+			if(curr->parent->left == curr) setLink(curr->parent->left, right);
+			else setLink(curr->parent->right, right);
 		}
-		else root = right;
+		else setLink(root, right);
 
 		// Make the connection between (current,right's left)
 		if(right->left) right->left->parent = curr;
-		curr->right = right->left;
+		setLink(curr->right, right->left);
 		
 
 		// Make the connection between (current,right)
-		right->left = curr;
+		setLink(right->left, curr);
 		curr->parent = right;
 
 		// Update the heights of current and right, both of which have new children
-		curr->height = max(curr->left ? curr->left->height : 0, 
+		curr->height = std::max(curr->left ? curr->left->height : 0, 
 			curr->right ? curr->right->height : 0) + 1;
-		right->height = max(right->left ? right->left->height : 0, 
+		right->height = std::max(right->left ? right->left->height : 0, 
 			right->right ? right->right->height : 0) + 1;
+		curr->size = count(curr->left) + count(curr->right) + 1;
+		right->size = count(right->left) + count(right->right) + 1;
 	} 
 
  	/* ****************************************************************************************** */
 	void rotateRight (Node* curr, Node* left) {
 
 		if(dbg) {
-			printf("%s: %s, %s\n", __FUNCTION__, toStr(curr->value).c_str(), toStr(left->value).c_str());
+			printf("%s: %s, %s\n", __FUNCTION__, str(curr->value).c_str(), str(left->value).c_str());
 			printf("\tcurr height0: %d, left height0: %d\n", curr->height, left->height);
 		}
 
 		// Make the connection between (current's parent,left)
 		left->parent = curr->parent;
 		if(curr->parent) {
-			if(curr->parent->right == curr) curr->parent->right = left;
-			else curr->parent->left = left;
+			if(curr->parent->right == curr) setLink(curr->parent->right, left);
+			else setLink(curr->parent->left, left);
 		}
-		else root = left;
+		else setLink(root, left);
 
 		// Make the connection between (current,left's right)
 		if(left->right) left->right->parent = curr;
-		curr->left = left->right;
+		setLink(curr->left, left->right);
 
 		// Make the connection between (current,left)
-		left->right = curr;
+		setLink(left->right, curr);
 		curr->parent = left;
 
 		// Update the heights of current and left, both of which have new children
-		curr->height = max(curr->right ? curr->right->height : 0, 
+		curr->height = std::max(curr->right ? curr->right->height : 0, 
 			curr->left ? curr->left->height : 0) + 1;
-		left->height = max(left->right ? left->right->height : 0, 
+		left->height = std::max(left->right ? left->right->height : 0, 
 			left->left ? left->left->height : 0) + 1;
+		curr->size = count(curr->left) + count(curr->right) + 1;
+		left->size = count(left->left) + count(left->right) + 1;
 		if(dbg) printf("\tcurr height: %d, left height: %d\n", curr->height, left->height);
 	} 
 	
  	/* ****************************************************************************************** */
-	/// Balances the tree with rotations
-	void retrace (Node* curr) {
+	/// Balances the tree with rotations from curr up, after a node was added (delta = 1) or removed
+	/// (delta = -1) below it; without Balanced only the heights and the sizes are updated. Once a
+	/// subtree is back to its old height, the heights and balances above it do not change, so only
+	/// the sizes are updated from there.
+	void retrace (Node* curr, int delta) {
 
-		return;
-		if(dbg) printf("Retrace for '%s'\n", toStr(curr->value).c_str());
+		if(dbg) printf("Retrace for '%s'\n", str(curr->value).c_str());
 
-		int counter = 0;
 		while(curr != NULL) {
-			if(counter++ > 10) break;
 
-			// Update the height
-			curr->height = max(curr->left ? curr->left->height : 0, 
+			// Update the height and the size
+			int oldHeight = curr->height;
+			curr->height = std::max(curr->left ? curr->left->height : 0, 
 				curr->right ? curr->right->height : 0) + 1;
+			curr->size = count(curr->left) + count(curr->right) + 1;
 
 			// Look at the left rotations (current balance is +2)
 			int currBalance = (curr->right ? curr->right->height : 0) -
 				(curr->left ? curr->left->height : 0);
 			if(dbg) 
-				printf("curr: '%s', balance: %d, height: %d\n", toStr(curr->value).c_str(), currBalance, 
+				printf("curr: '%s', balance: %d, height: %d\n", str(curr->value).c_str(), currBalance, 
 				curr->height);
 
-			if(currBalance > 1) {
+			Node* top = curr;
+			if(!Balanced) {}
+			else if(currBalance > 1) {
 	
 				// Find out the children's balances
 				Node* right = curr->right;
@@ -283,14 +654,14 @@ struct AVL {
 					rotateRight(curr->right, curr->right->left);
 					rotateLeft(curr, curr->right);
 				}
-				
+				top = curr->parent;
 			}
 			
 			else if(currBalance < -1) {
 
 				Node *left = curr->left;
 				int leftBalance = (left->left ? left->left->height : 0) -
-					(left->left ? left->left->height : 0);
+					(left->right ? left->right->height : 0);
 
 				// Case 2: Perform left rotation
 				if(leftBalance >= 0) {
@@ -304,171 +675,155 @@ struct AVL {
 					rotateLeft(curr->left, curr->left->right);
 					rotateRight(curr, curr->left);
 				}
+				top = curr->parent;
 			}
 
-			// Update the parents height after all the rotations
-			if(curr->parent) 
-				curr->parent->height = max(curr->parent->left ? curr->parent->left->height : 0, 
-					curr->parent->right ? curr->parent->right->height : 0) + 1;
-
-			// Retrace the parent next
-			curr = curr->parent;
+			// Retrace the parent next, unless the subtree kept its height
+			curr = top->parent;
+			if(top->height == oldHeight) break;
 		}
+
+		for(; curr != NULL; curr = curr->parent) curr->size += delta;
 	}
 
  	/* ****************************************************************************************** */
-  void insert (const X& x) { 
-		if(dbg) printf("\n%s: %s\n", __FUNCTION__, toStr(x).c_str());
-		if(root == NULL) root = new Node(x, NULL);
-		else {
-			Node* newNode = insert(x,root);
-			retrace(newNode);
-		}
+	/// Checks the links, the order, the heights, the balances and the sizes of the subtree and
+	/// returns its height. Debug builds (AVL_DEBUG) run it on the tree after every change.
+	int check (Node* curr) {
+		if(curr == NULL) return 0;
+		if(curr->left != NULL) assert((curr->left->parent == curr) && comp(curr->left->value, curr->value));
+		if(curr->right != NULL) assert((curr->right->parent == curr) && comp(curr->value, curr->right->value));
+		int left = check(curr->left), right = check(curr->right);
+		assert((!Balanced || (abs(left - right) <= 1)) && (curr->height == std::max(left, right) + 1));
+		assert(curr->size == count(curr->left) + count(curr->right) + 1);
+		return curr->height;
 	}
 
  	/* ****************************************************************************************** */
-	Node* insert (const X& x, Node* curr) {
-
-		// Check for the left insertion
-		Node* newNode;
-		if(comp(x, curr->value)) {
-			if(curr->left != NULL) newNode = insert(x, curr->left);
-			else {
-				curr->left = new Node(x, curr);
-				newNode = curr->left;
-			}
+	/// Adds the value at a leaf found top-down (nothing if it is already there) and rebalances
+  void insert (const X& x) { 
+		if(dbg) printf("\n%s: %s\n", __FUNCTION__, str(x).c_str());
+		Node* parent = NULL, *curr = root;
+		bool left = false;
+		while(curr != NULL) {
+			if(comp(x, curr->value)) left = true;
+			else if(comp(curr->value, x)) left = false;
+			else return;
+			parent = curr;
+			curr = left ? curr->left : curr->right;
 		}
-		
-		// Check for the right insertion
-		else if(comp(curr->value, x)) {
-			if(curr->right != NULL) newNode = insert(x, curr->right);
-			else {
-				curr->right = new Node(x, curr);
-				newNode = curr->right;
-			}
+		Node* newNode = allocNode(x, parent);
+		if(parent == NULL) setLink(root, newNode);
+		else {
+			if(left) setLink(parent->left, newNode);
+			else setLink(parent->right, newNode);
+			retrace(parent, 1);
 		}
-
-		else return curr;
-
-		curr->height = max(curr->left ? curr->left->height : 0, 
-			curr->right ? curr->right->height : 0) + 1;
-		return newNode;
-	} 
+		if(dbg) check(root);
+	}
 
  	/* ****************************************************************************************** */
+	/// Finds the value top-down, unlinks its node and rebalances
   void remove (const X& x) { 
-		if(root == NULL) return;
-		else {
-			Node* temp = remove(x,root);
-			if(temp != NULL) retrace(temp);
+		if(dbg) printf("\n%s: %s\n", __FUNCTION__, str(x).c_str());
+		Node* curr = root;
+		while(curr != NULL) {
+			if(comp(x, curr->value)) curr = curr->left;
+			else if(comp(curr->value, x)) curr = curr->right;
+			else break;
 		}
+		if(curr == NULL) return;
+		Node* from = unlink(curr);
+		if(from != NULL) retrace(from, -1);
+		if(dbg) check(root);
 	}
 
  	/* ****************************************************************************************** */
 	void connect (Node* child, Node* parent, bool left) {
 		if(child != NULL) child->parent = parent;
 		if(parent != NULL) {
-			if(left) parent->left = child;
-			else parent->right = child;
+			if(left) setLink(parent->left, child);
+			else setLink(parent->right, child);
 		}
 	}
 
  	/* ****************************************************************************************** */
-	Node* remove (const X& x, Node* curr) {
-
-		if(dbg) 
-			printf("\n%s: %s, node: %s\n", __FUNCTION__, toStr(x).c_str(), toStr(curr->value).c_str());
-
-		// Check the left side 
-		if(curr->left != NULL && comp(x, curr->value)) return remove(x, curr->left); 
-
-		// Check the right side 
-		else if(curr->right != NULL && comp(curr->value, x)) return remove(x, curr->right); 
-
-		// Check if this node should be removed
-		if(!comp(curr->value, x) && !comp(x, curr->value)) {
-
-			// Case 0: No children
-			if(curr->left == NULL && curr->right == NULL) {
-				if(dbg) printf("Case 0\n");
-				if(curr->parent) {
-					if(curr->parent->left == curr) curr->parent->left = NULL;
-					else curr->parent->right = NULL;
-					return curr->parent;
-				}
-				else {
-					root = NULL;
-					return NULL;
-				}
-			}
-
-			// Case 1a: Only left child
-			else if(curr->left != NULL && curr->right == NULL) {
-				if(dbg) printf("Case 1a\n");
-				if(curr->parent) {
-					connect(curr->left, curr->parent, (curr->parent->left == curr));
-					return curr->parent;
-				}
-				else {
-					root = curr->left;
-					curr->left->parent = NULL;
-					return NULL;
-				}
+	/// Takes the node out of the tree and frees it. Returns the lowest node whose subtree changed,
+	/// where the rebalancing starts, or NULL if there is none.
+	Node* unlink (Node* curr) {
+
+		// Case 0: No children
+		if(curr->left == NULL && curr->right == NULL) {
+			if(dbg) printf("Case 0\n");
+			Node* parent = curr->parent;
+			if(parent) {
+				if(parent->left == curr) setLink(parent->left, NULL);
+				else setLink(parent->right, NULL);
 			}
+			else setLink(root, NULL);
+			freeNode(curr);
+			return parent;
+		}
 
-			// Case 1b: Only right child
-			else if(curr->left == NULL && curr->right != NULL) {
-				if(dbg) printf("Case 1b\n");
-				if(curr->parent) {
-					connect(curr->right, curr->parent, (curr->parent->left == curr));
-					return curr->parent;
-				}
-				else {
-					root = curr->right;
-					curr->right->parent = NULL;
-					return NULL;
-				}
+		// Case 1a: Only left child
+		else if(curr->left != NULL && curr->right == NULL) {
+			if(dbg) printf("Case 1a\n");
+			Node* parent = curr->parent;
+			if(parent) connect(curr->left, parent, (parent->left == curr));
+			else {
+				setLink(root, curr->left);
+				curr->left->parent = NULL;
 			}
+			freeNode(curr);
+			return parent;
+		}
 
-			// Case 2: two children
+		// Case 1b: Only right child
+		else if(curr->left == NULL && curr->right != NULL) {
+			if(dbg) printf("Case 1b\n");
+			Node* parent = curr->parent;
+			if(parent) connect(curr->right, parent, (parent->left == curr));
 			else {
-				if(dbg) printf("Case 2\n");
-
-				// Find the successor node (left most node of the right subtree)
-				Node* succ = curr->right;
-				while(true) {
-					if(succ->left) succ = succ->left;
-					else break;
-				}
-				if(dbg) printf("\tsucc: %s\n", toStr(succ->value).c_str());
-
-				// Set the successor at the current location
-				if(curr->parent) {
-					if(succ != curr->right) connect(curr->right, succ, false);
-					if(succ->parent) {
-						if(succ->parent->left == succ) succ->parent->left = NULL;
-						else succ->parent->right = NULL;
-					}
-					connect(succ, curr->parent, (curr->parent->left == curr));
-					connect(curr->left, succ, true);
-					return succ;
-				}
-				else {
-					root = succ;
-					connect(curr->left, root, true);
-					if(succ != curr->right) connect(curr->right, succ, false);
-					if(succ->parent) {
-						if(succ->parent->left == succ) succ->parent->left = NULL;
-						else succ->parent->right = NULL;
-					}
-					succ->parent = NULL;
-					return NULL;
-				}
-
+				setLink(root, curr->right);
+				curr->right->parent = NULL;
 			}
+			freeNode(curr);
+			return parent;
 		}
 
-		return NULL;
+		// Case 2: two children
+		if(dbg) printf("Case 2\n");
+
+		// Find the successor node (left most node of the right subtree)
+		Node* succ = curr->right;
+		while(true) {
+			if(succ->left) succ = succ->left;
+			else break;
+		}
+		if(dbg) printf("\tsucc: %s\n", str(succ->value).c_str());
+
+		// Move the successor's right child up to its place, then the successor to the current
+		// location. The successor takes over the height and the size there, and the subtrees
+		// change from its old parent up.
+		Node* from = succ;
+		if(succ != curr->right) {
+			from = succ->parent;
+			connect(succ->right, from, true);
+			connect(curr->right, succ, false);
+		}
+		connect(curr->left, succ, true);
+		if(curr->parent) connect(succ, curr->parent, (curr->parent->left == curr));
+		else {
+			setLink(root, succ);
+			succ->parent = NULL;
+		}
+		succ->height = curr->height;
+		succ->size = curr->size;
+		freeNode(curr);
+		return from;
 	}
 
+private:
+	AVL (const AVL&);
+	AVL& operator= (const AVL&);
 };
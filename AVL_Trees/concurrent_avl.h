@@ -0,0 +1,98 @@
+/**
+ * @file concurrent_avl.h
+ * @date 2015-08-07
+ * @author Can Erdogan
+ * @brief An AVL tree for many readers and few writers. Writers take a lock and bump a sequence
+ * number before and after changing the tree (a seqlock); readers take no lock, search the tree
+ * and retry if the sequence number changed meanwhile.
+ * A reader that races with a writer may follow a node that is being rotated or was just removed,
+ * but the nodes live in the pool slabs, which stay allocated, so it only reads stale values that
+ * the validation throws away. For these reads to be well defined, the writers in avl.h store the
+ * links and the values atomically (setLink, AtomicValue) and the readers load them atomically:
+ * the links with acquire, so a reader that reaches a new node sees its contents, and the values
+ * with a speculative relaxed copy. The values must therefore be trivially copyable and fit in a
+ * lock-free word. Compile with -std=c++11 -pthread.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include "avl.h"
+
+/* ******************************************************************************************** */
+template <class X, class Comp = std::less <X> >
+struct ConcurrentAVL {
+
+	typedef typename AVL <X, Comp>::Node Node;
+	static_assert(std::is_trivially_copyable <X>::value, "The readers copy values speculatively");
+	static_assert(AVL <X, Comp>::AtomicValue::value, "The values must be stored atomically");
+
+	static const int maxAttempts = 8;				///< Optimistic reads before a reader takes the lock
+	static const int maxSteps = 64;					///< Longer paths than any AVL tree can have
+
+	AVL <X, Comp> tree;
+	std::atomic <unsigned> sequence;				///< Odd while a writer changes the tree
+	std::mutex writeLock;
+
+	ConcurrentAVL (const Comp& comp = Comp()) : tree(comp), sequence(0) {}
+
+	/* ****************************************************************************************** */
+	void insert (const X& x) {
+		std::lock_guard <std::mutex> lock (writeLock);
+		beginWrite();
+		tree.insert(x);
+		endWrite();
+	}
+
+	void remove (const X& x) {
+		std::lock_guard <std::mutex> lock (writeLock);
+		beginWrite();
+		tree.remove(x);
+		endWrite();
+	}
+
+	inline void beginWrite () {
+		sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	inline void endWrite () {
+		sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/* ****************************************************************************************** */
+	/// Returns true if x is in the tree. Searches without the lock while no writer interferes, and
+	/// with it after a few failed attempts so that readers always finish.
+	bool contains (const X& x) {
+		for(int attempt = 0; attempt < maxAttempts; attempt++) {
+			unsigned s = sequence.load(std::memory_order_acquire);
+			if(s & 1) {
+				std::this_thread::yield();
+				continue;
+			}
+			int found = search(x);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if((found != -1) && (sequence.load(std::memory_order_relaxed) == s)) return found;
+		}
+		std::lock_guard <std::mutex> lock (writeLock);
+		return (tree.search(x) != NULL);
+	}
+
+	/// Returns 1 if found, 0 if not, and -1 if the path was too long to be from a consistent tree
+	int search (const X& x) const {
+		Node* curr = __atomic_load_n(&tree.root, __ATOMIC_ACQUIRE);
+		for(int steps = 0; curr != NULL; steps++) {
+			if(steps > maxSteps) return -1;
+			X value;
+			__atomic_load(&curr->value, &value, __ATOMIC_RELAXED);
+			if(tree.comp(x, value)) curr = __atomic_load_n(&curr->left, __ATOMIC_ACQUIRE);
+			else if(tree.comp(value, x)) curr = __atomic_load_n(&curr->right, __ATOMIC_ACQUIRE);
+			else return 1;
+		}
+		return 0;
+	}
+};
+/* ******************************************************************************************** */
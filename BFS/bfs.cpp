@@ -2,203 +2,178 @@
  * @file bfs.cpp
  * @author Can Erdogan
  * @date July 12, 2015
- * @brief Implementation of breadth-first search for the 8-puzzle example in Russell & Norvig AI 
+ * @brief Implementation of breadth-first search for the 8-puzzle example in Russell & Norvig AI
  * book. Start state: 7 2 4; 5 N 6; 8 3 1. Goal state: N 1 2; 3 4 5; 6 7 8.
+ * A board is packed into a 64-bit word with 4 bits per cell (cell i, in row-major order, in
+ * bits 4i..4i+3) and 0 for the empty cell, so boards up to 4x4 (the 15-puzzle) fit and a move is
+ * a few shifts. Other boards can be given as tiles in row-major order: ./a.out [-d] [-r <rows>]
+ * <tiles>, e.g. ./a.out 4 1 2 3 5 0 6 7 8 9 10 11 12 13 14 15.
+ * With -e <#threads> first, the whole state space reachable from the board is enumerated level
+ * by level in parallel and the number of states at each depth is printed instead, e.g. the
+ * distances of all 8-puzzle configurations to the goal: ./a.out -e 4 0 1 2 3 4 5 6 7 8.
+ * Compile with -std=c++11 -pthread.
  */
 
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
 #include <iostream>
 #include <math.h>
 #include <queue>
-#include <set>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/time.h>
+#include <thread>
 #include <vector>
+#include "puzzle.h"
 
 using namespace std;
 
 bool debugVis = false;			///< Visualize the search with graphviz
-#define digit(number,n) ((number/((int) pow(10, n)))%10)	 ///< Returns the nth digit of a #
 
 /* ******************************************************************************************** */
-struct State {
-	int depth;		
-	int actionBefore;
-	int val;
-	State* prev;
-	State (int d, int a, int v, State* p) : depth(d), actionBefore(a), val(v), prev(p) {}
-};
-queue <State*> states; 	/// A state is a 9 digit number with 0 representing the empty cell
+queue <uint32_t> states; 	/// A state is a packed board with 0 representing the empty cell
 vector <int> actions;
-int offsets [4] = {-3, -1, 3, 1};
-
-/* ******************************************************************************************** */
-inline int applyAction (int val, int index, int actionIdx) {
-
-	static const bool dbg = 0;
-	int offset = offsets[actionIdx];
-	int new_index = index + offset;
-	if(dbg) printf("%d vs. %d, %d, idx: %d\n", index, new_index, offset, actionIdx);
-	assert((actionIdx >= 0) && (actionIdx <= 3));
-	if((new_index < 0) | (new_index > 8)) {
-		if(dbg) printf("\treason 1\n");
-		return -1;
-	}
-	if(((offset == 1) || (offset == -1)) && ((index / 3) != (new_index / 3))) {
-		if(dbg) printf("\treason 2\n");
-		return -1;
-	}
-
-	// Get the digit that is being moved to the empty cell
-	int tenthPowerNew = ((int) pow(10, new_index));
-	int digitNew = (val / tenthPowerNew) % 10;
-
-	// Create the new val by removing the new digit value 
-	int tenthPowerOld = ((int) pow(10, index));
-	int new_val = val - digitNew * (tenthPowerNew - tenthPowerOld);
-	return new_val;
-}
-
-/* ******************************************************************************************** */
-/// Generates new states in the search tree from the input and pushes them onto the stack
-void generateStates (State& state) {
-
-	// Find the location of the empty cell
-	int index = -1;
-	int val = state.val;
-	int val_ = val;
-	for(size_t i = 0; i < 9; i++) {
-		if(val_ % 10 == 0) {
-			index = i;
-			break;
-		}
-		val_ /= 10;
-	}
-	
-	// Generate the new val based on the location
-	for(size_t n = 0; n < 4; n++) {
-
-		// Get the possible neighbor and see if it exists
-		int new_index = index + offsets[n];
-		// printf("%d vs. %d\n", index, new_index);
-		if((new_index < 0) | (new_index > 8)) continue;
-		if(((offsets[n] == 1) || (offsets[n] == -1)) && ((index / 3) != (new_index / 3))) continue;
-
-		// Get the digit that is being moved to the empty cell
-		int tenthPowerNew = ((int) pow(10, new_index));
-		int digitNew = (val / tenthPowerNew) % 10;
-	
-		// Create the new val by removing the new digit value 
-		int tenthPowerOld = ((int) pow(10, index));
-		int new_val = val - digitNew * (tenthPowerNew - tenthPowerOld);
-		
-		// Push to the stack
-		// printf("\t%09d\n", new_val);
-		states.push(new State(state.depth + 1, n, new_val, &state));
-	}
-}
 
 /* ******************************************************************************************** */
 void printStack() {
 	while(!states.empty()) {
-		int s = states.front()->val;
+		Board s = arena[states.front()].val;
 		states.pop();
-		printf("%09d\n", s);
+		printf("%016llx\n", (unsigned long long) s);
 	}
 }
 
 /* ******************************************************************************************** */
-void printState (int s) {
-	int a = (s / ((int) 1e6));
-	int b = ((s / ((int) 1e3))) % 1000;
-	int c = s % 1000;
-	printf("%03d\n%03d\n%03d\n", a, b, c);
+double now () {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1e-6 * tv.tv_usec;
 }
 
 /* ******************************************************************************************** */
 /// Implements DFS and outputs the path of actions that reaches the goal state if one exists
 /// Returns true if the goal is reached; false, otherwise.
-bool dfs (State& s0) {
+bool dfs (uint32_t s0) {
 
 	// Keep track of seen states to avoid loops
-	set <int> seen;
-	seen.insert(s0.val);
-	
+	Visited seen;
+	seen.init();
+	seen.insert(arena[s0].val);
+
 	// Populate stack using initial state
-	generateStates(s0);
+	generateStates(s0, states);
 	static const bool dbg = 0;
 
 	// Keep searching until there is children states
 	while(!states.empty()) {
 
 		// Get the child state
-		State* state = states.front();	
-		int val = state->val;
+		uint32_t idx = states.front();
+		const State& state = arena[idx];
+		Board val = state.val;
 		states.pop();
-		
+
 		// Debug information
 		if(dbg) {
-			printf("=== level: %d ======> \n", state->depth);
+			printf("=== level: %d ======> \n", (int) state.depth);
 			printState(val);
 			// getchar();
 		}
 
 		// Check if the child is seen
-		if(seen.find(val) != seen.end()) {
+		if(!seen.insert(val)) {
 			if(dbg) printf(">>>>> seen before.\n");
 			continue;
 		}
-		seen.insert(val);
 
 		// Check if the child is the goal
-		if(val == 12345678) {
-			State* s = state;
-			while(s != NULL) {
-				if(s->actionBefore != -1) actions.push_back(s->actionBefore);
-				s = s->prev;
-			}
-			printf("# of actions: %d\n", actions.size());
+		if(val == goal) {
+			for(uint32_t s = idx; arena[s].prev != NONE; s = arena[s].prev)
+				actions.push_back(arena[s].actionBefore);
+			printf("# of actions: %lu\n", actions.size());
 			return true;
 		}
 
 		// Generate grandchildren
-		generateStates(*state);
+		generateStates(idx, states);
 		if(dbg) printf(">>>>> not yet.\n");
-	} 
-	
+	}
+
 	assert(false && "NO SOLUTION\n");
 	return false;
 }
 
 /* ******************************************************************************************** */
-void applyActions (int s) {
+/// Counts the states at each distance from s0 with a level-synchronous BFS on numThreads threads.
+/// The threads take chunks of the current frontier through an atomic counter and claim each
+/// successor by setting its bit in the visited bitmap with an atomic or, so every state enters
+/// the next frontier exactly once. No tree is kept: a frontier is just an array of boards.
+void enumerate (Board s0, int numThreads) {
+
+	// The bitmap over the permutation ranks: 30 MB for 3x4, but 16!/2 bits (1.3 TB) for 4x4
+	assert((numCells <= 12) && "The visited bitmap does not fit in memory for this board");
+	vector <atomic <uint64_t> > bits (numCells * numHalfPerms / 64 + 1);
+	for(size_t i = 0; i < bits.size(); i++) bits[i].store(0, memory_order_relaxed);
+	uint64_t r0 = permutationRank(s0);
+	bits[r0 >> 6] |= ((uint64_t) 1) << (r0 & 63);
+
+	// Expand a level at a time; each thread collects its part of the next level
+	vector <Board> frontier (1, s0);
+	vector <vector <Board> > local (numThreads);
+	uint64_t total = 0;
+	double t0 = now();
+	printf("%5s %12s\n", "depth", "#states");
+	for(int depth = 0; !frontier.empty(); depth++) {
+		printf("%5d %12lu\n", depth, frontier.size());
+		total += frontier.size();
+		atomic <size_t> next (0);
+		vector <thread> threads;
+		for(int t = 0; t < numThreads; t++) {
+			threads.push_back(thread([&, t] () {
+				static const size_t chunk = 1024;
+				vector <Board>& out = local[t];
+				out.clear();
+				for(size_t i = next.fetch_add(chunk); i < frontier.size(); i = next.fetch_add(chunk)) {
+					size_t end = min(i + chunk, frontier.size());
+					for(size_t j = i; j < end; j++) {
+						int index = blankCell(frontier[j]);
+						for(int a = 0; a < 4; a++) {
+							if(moves[index][a] == -1) continue;
+							Board val = applyAction(frontier[j], index, a);
+							uint64_t r = permutationRank(val), mask = ((uint64_t) 1) << (r & 63);
+							if(bits[r >> 6].load(memory_order_relaxed) & mask) continue;
+							if(!(bits[r >> 6].fetch_or(mask, memory_order_relaxed) & mask)) out.push_back(val);
+						}
+					}
+				}
+			}));
+		}
+		for(int t = 0; t < numThreads; t++) threads[t].join();
+		frontier.clear();
+		for(int t = 0; t < numThreads; t++) frontier.insert(frontier.end(), local[t].begin(), local[t].end());
+	}
+	double elapsed = now() - t0;
+	printf("%lu states on %d threads in %.3lf s: %.0lf states/s\n", total, numThreads, elapsed,
+		total / elapsed);
+}
+
+/* ******************************************************************************************** */
+void applyActions (Board s) {
 
 	printf("\nInitial state:\n");
 	printState(s);
 
-	int val = s;
-	int step = actions.size() / 10;
+	Board val = s;
 	for(int act_idx = actions.size()-1; act_idx >= 0; act_idx--) {
 
-		
-		// Find where the empty cell is
-		int index = -1;
-		int val_ = val;
-		for(size_t i = 0; i < 9; i++) {
-			if(val_ % 10 == 0) {
-				index = i;
-				break;
-			}
-			val_ /= 10;
-		}
-	
-		// Apply the action
-		int val2 = applyAction(val, index, actions[act_idx]);
-		val = val2;
-		assert(val != -1);
+		// Apply the action at the empty cell
+		val = applyAction(val, blankCell(val), actions[act_idx]);
+		assert(val != 0);
 		if(act_idx < 10) {
-			printf("\nState %d:\n", actions.size() - act_idx);
+			printf("\nState %lu:\n", actions.size() - act_idx);
 			printState(val);
 		}
 	}
@@ -211,12 +186,40 @@ void applyActions (int s) {
 int main (int argc, char* argv[]) {
 
 	// Parse the input
-	if((argc > 1) && (strcmp(argv[1], "-d") == 0)) debugVis = true;
+	int arg = 1, numThreads = 0;
+	bool rowsGiven = false;
+	if((argc > arg + 1) && (strcmp(argv[arg], "-e") == 0)) numThreads = atoi(argv[arg + 1]), arg += 2;
+	if((argc > arg) && (strcmp(argv[arg], "-d") == 0)) debugVis = true, arg++;
+	if((argc > arg + 1) && (strcmp(argv[arg], "-r") == 0)) {
+		rows = atoi(argv[arg + 1]), arg += 2;
+		rowsGiven = true;
+	}
+
+	// Read the board or use the book example
+	Board s0 = 0;
+	int tiles [] = {7, 2, 4, 5, 0, 6, 8, 3, 1};
+	numCells = (argc > arg) ? (argc - arg) : 9;
+	if(!rowsGiven) rows = (int) (sqrt(numCells) + 0.5);
+	cols = numCells / rows;
+	assert((rows * cols == numCells) && (numCells <= 16) && "Bad board size");
+	for(int i = 0; i < numCells; i++) {
+		Board t = (argc > arg) ? atoi(argv[arg + i]) : tiles[i];
+		assert(t < (Board) numCells);
+		s0 |= t << (4 * i);
+	}
+	initMoves();
+
+	// Enumerate the state space instead of searching for the goal
+	if(numThreads > 0) {
+		enumerate(s0, numThreads);
+		return 0;
+	}
 
 	// Perform DFS
-	int s0 = 724506831;
-	State state0 (0,-1,s0,NULL);
-	dfs(state0);
+	double t0 = now();
+	dfs(arena.alloc(s0, NONE, 0, 0));
+	printStats(now() - t0);
+	arena.release();
 
 	// Apply actions to the initial state
 	applyActions(s0);
@@ -0,0 +1,224 @@
+/**
+ * @file puzzle.h
+ * @author Can Erdogan
+ * @date July 12, 2015
+ * @brief The sliding tile puzzle boards shared by the BFS and DFS solvers. A board is packed into
+ * a 64-bit word with 4 bits per cell (cell i, in row-major order, in bits 4i..4i+3) and 0 for the
+ * empty cell, so boards up to 4x4 (the 15-puzzle) fit and a move is a few shifts. The board size
+ * is global: set rows, cols and numCells, then call initMoves(). The search tree nodes live in a
+ * shared arena and are expanded into whichever frontier the solver keeps.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <vector>
+
+#define tile(board,i) (((board) >> (4 * (i))) & 0xF)	 ///< Returns the tile at the ith cell
+
+/* ******************************************************************************************** */
+typedef uint64_t Board;
+
+int rows = 3, cols = 3, numCells = 9;
+int moves [16][4];							///< New empty cell for each empty cell and action, -1 if illegal
+Board unusedCells;							///< All-ones nibbles above the last cell (for blankCell)
+Board goal;
+uint64_t numHalfPerms;					///< (numCells-1)!/2, orderings of the tiles with a given parity
+
+/* ******************************************************************************************** */
+/// Fills the move table for the board size so that no successor needs a bounds check
+void initMoves () {
+	for(int index = 0; index < numCells; index++) {
+		int r = index / cols, c = index % cols;
+		moves[index][0] = (r > 0) ? index - cols : -1;
+		moves[index][1] = (c > 0) ? index - 1 : -1;
+		moves[index][2] = (r < rows - 1) ? index + cols : -1;
+		moves[index][3] = (c < cols - 1) ? index + 1 : -1;
+	}
+	unusedCells = (numCells == 16) ? 0 : (~((Board) 0) << (4 * numCells));
+	goal = 0;
+	for(int i = 0; i < numCells; i++) goal |= ((Board) i) << (4 * i);
+	numHalfPerms = 1;
+	for(int i = 3; i < numCells; i++) numHalfPerms *= i;
+}
+
+/* ******************************************************************************************** */
+/// Returns the index of the empty cell: the lowest zero nibble, found with the "has zero byte"
+/// trick on nibbles. Borrows can only create false positives above the first zero nibble.
+inline int blankCell (Board val) {
+	static const Board ones = 0x1111111111111111ULL, highs = 0x8888888888888888ULL;
+	Board v = val | unusedCells;
+	Board zeros = (v - ones) & ~v & highs;
+	return __builtin_ctzll(zeros) / 4;
+}
+
+/* ******************************************************************************************** */
+/// Returns a dense index of the board among the numCells!/2 reachable ones. A move never
+/// changes the parity of the order of the tiles (without the empty cell) on odd widths, and
+/// changes it with the row of the empty cell on even widths, so the empty cell and a Lehmer
+/// code of the tiles without its last two digits (fixed by the parity, and always 0) suffice.
+/// Each Lehmer digit is the number of smaller tiles yet to come, found with a popcount.
+inline uint64_t permutationRank (Board val) {
+	int m = numCells - 1;
+	uint64_t r = 0;
+	unsigned used = 0;
+	for(int i = 0, k = 0; k < m - 2; i++) {
+		int t = tile(val, i);
+		if(t == 0) continue;
+		r = r * (m - k) + (t - 1 - __builtin_popcount(used & ((1u << t) - 1)));
+		used |= (1u << t);
+		k++;
+	}
+	return blankCell(val) * numHalfPerms + r;
+}
+
+/* ******************************************************************************************** */
+/// Visited set: a bitmap over the permutation ranks if it fits (181,440 bits = 23 KB for the
+/// 8-puzzle) and an open-addressing hash set of boards otherwise (the 15-puzzle would need 16!/2
+/// bits). Valid boards are never 0, which marks the empty hash slots.
+struct Visited {
+
+	bool perfect;
+	std::vector <uint64_t> bits;
+	std::vector <Board> table;
+	size_t count;
+
+	void init () {
+		perfect = (numCells <= 12);
+		if(perfect) bits.assign(numCells * numHalfPerms / 64 + 1, 0);
+		else table.assign(1 << 20, 0);
+		count = 0;
+	}
+
+	/// Adds the board; returns false if it was already in the set
+	inline bool insert (Board val) {
+		if(perfect) {
+			uint64_t r = permutationRank(val), mask = ((uint64_t) 1) << (r & 63);
+			if(bits[r >> 6] & mask) return false;
+			bits[r >> 6] |= mask;
+			return true;
+		}
+		if(2 * (count + 1) > table.size()) grow();
+		size_t mask = table.size() - 1;
+		for(size_t i = hash(val) & mask; ; i = (i + 1) & mask) {
+			if(table[i] == val) return false;
+			if(table[i] == 0) {
+				table[i] = val;
+				count++;
+				return true;
+			}
+		}
+	}
+
+	static inline size_t hash (Board val) { return (val * 0x9E3779B97F4A7C15ULL) >> 20; }
+
+	/// Doubles the hash table to keep the load factor under 1/2
+	void grow () {
+		std::vector <Board> old;
+		old.swap(table);
+		table.assign(2 * old.size(), 0);
+		size_t mask = table.size() - 1;
+		for(size_t j = 0; j < old.size(); j++) {
+			if(old[j] == 0) continue;
+			size_t i = hash(old[j]) & mask;
+			while(table[i] != 0) i = (i + 1) & mask;
+			table[i] = old[j];
+		}
+	}
+};
+
+/* ******************************************************************************************** */
+/// Moves the tile next to the empty cell into it. Returns 0 (not a valid board) if illegal.
+inline Board applyAction (Board val, int index, int actionIdx) {
+
+	static const bool dbg = 0;
+	assert((actionIdx >= 0) && (actionIdx <= 3));
+	int new_index = moves[index][actionIdx];
+	if(dbg) printf("%d vs. %d, idx: %d\n", index, new_index, actionIdx);
+	if(new_index == -1) return 0;
+
+	// Move the tile at the new empty cell to the old one
+	Board t = tile(val, new_index);
+	return val - (t << (4 * new_index)) + (t << (4 * index));
+}
+
+/* ******************************************************************************************** */
+static const uint32_t NONE = 0xFFFFFFFF;		///< Parent of the initial state
+
+/// A node of the search tree in 16 bytes, with its parent as an index into the arena
+struct State {
+	Board val;
+	uint32_t prev;
+	uint32_t depth : 30;
+	uint32_t actionBefore : 2;
+};
+
+/// Bump allocator for the states: fixed-size slabs that never move, so indices (and references)
+/// stay valid as it grows, and which are all released at once after the search
+struct Arena {
+
+	static const int slabBits = 16;						///< 64K states (1 MB) per slab
+	std::vector <State*> slabs;
+	uint32_t count;
+
+	Arena () : count(0) {}
+	~Arena () { release(); }
+
+	inline State& operator[] (uint32_t i) { return slabs[i >> slabBits][i & ((1 << slabBits) - 1)]; }
+
+	/// Returns the index of a new state
+	inline uint32_t alloc (Board val, uint32_t prev, uint32_t depth, int actionBefore) {
+		assert((count != NONE) && "Too many states");
+		if((count & ((1 << slabBits) - 1)) == 0)
+			slabs.push_back((State*) malloc(sizeof(State) << slabBits));
+		State& s = (*this)[count];
+		s.val = val, s.prev = prev, s.depth = depth, s.actionBefore = actionBefore;
+		return count++;
+	}
+
+	void release () {
+		for(size_t i = 0; i < slabs.size(); i++) free(slabs[i]);
+		slabs.clear();
+		count = 0;
+	}
+};
+
+Arena arena;
+
+/* ******************************************************************************************** */
+/// Generates new states in the search tree from the input and pushes them onto the frontier
+/// (the queue of BFS or the stack of DFS)
+template <class Frontier>
+void generateStates (uint32_t idx, Frontier& states) {
+
+	// Generate the new val based on the location of the empty cell
+	const State& state = arena[idx];
+	int index = blankCell(state.val);
+	for(size_t n = 0; n < 4; n++) {
+		if(moves[index][n] == -1) continue;
+		Board new_val = applyAction(state.val, index, n);
+		states.push(arena.alloc(new_val, idx, state.depth + 1, n));
+	}
+}
+
+/* ******************************************************************************************** */
+/// Prints the number of states created, the rate and the peak resident memory of the process
+void printStats (double seconds) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("# of states: %u, %.3lf s, %.0lf states/s, peak memory: %.1lf MB\n", arena.count,
+		seconds, arena.count / seconds, usage.ru_maxrss / 1024.0);
+}
+
+/* ******************************************************************************************** */
+/// Prints a row per line with a hex digit per tile (the 8-puzzle looks as before)
+void printState (Board s) {
+	for(int r = 0; r < rows; r++) {
+		for(int c = 0; c < cols; c++) printf("%X", (int) tile(s, r * cols + c));
+		printf("\n");
+	}
+}
+
+/* ******************************************************************************************** */
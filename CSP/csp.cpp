@@ -4,6 +4,18 @@
  * @date July 19, 2015
  * @brief Implementation of discrete constraint satisfaction for US map 4-coloring using 
  * heuristics such as min-conflict, least-constraint value, etc. 
+ * The plain backtracking search is compared with the engine of csp.h, which keeps a bitset of the
+ * values left for each variable, prunes it by forward checking or AC-3, and picks the variable
+ * with the fewest values left (MRV), breaking ties by the most unassigned neighbors (degree).
+ * Usage: ./a.out                                          (the US map in data.txt; draws graph.png)
+ *        ./a.out -r <#vars> <avg degree> [#values]        (a random problem with a planted solution)
+ *        ./a.out -g <#vars> <avg degree> <#values> <file> (writes such a problem like data.txt)
+ *        ./a.out -f <file> <#values>                      (solves a problem in the format of data.txt)
+ *        ./a.out -p <#vars> <avg degree> <#values> <#threads> <#problems>
+ *                                         (work stealing and portfolio speedups on random problems)
+ *        ./a.out -s <#clusters> <size> <degree in> <degree out> <#values> [planted]
+ *                                         (backjumping, nogoods and min-conflicts on clustered problems)
+ * Compile with -std=c++11 -pthread.
  */
 
 #include <assert.h>
@@ -15,7 +27,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/time.h>
 #include <vector>
+#include "csp.h"
 
 using namespace std;
 
@@ -39,11 +53,8 @@ void readFile () {
 
 	// Read the states and their neighbors
 	char line [256];
-	for(int i = 0; i < 51; i++) {
+	while(file.getline(line, 256)) {
 
-		// Get the next line
-		file.getline(line, 256);
-		
 		// Tokenize the line
 		int counter = 0;
 		char *p = strtok(line, "| {},[]");
@@ -81,13 +92,28 @@ void readFile () {
 }
 
 /* ********************************************************************************************* */
-int counter = 0;
+/// Creates the nodes of the plain search for a problem of the engine
+void makeNodes (const CSP& csp) {
+	vector <Node*> vars (csp.numVariables());
+	for(int i = 0; i < csp.numVariables(); i++) {
+		vars[i] = nodes[csp.name(i)] = new Node(csp.name(i));
+		unassigned.insert(vars[i]);
+	}
+	for(int i = 0; i < csp.numVariables(); i++) {
+		for(int e = csp.offsets[i]; e < csp.offsets[i+1]; e++) vars[i]->neighs.push_back(vars[csp.targets[e]]);
+	}
+}
+
+/* ********************************************************************************************* */
+long counter = 0;
+long maxCounter = 100000000;				///< The plain search gives up after this many assignments
+const long maxAssignments = 50000000;	///< The searches on the domains give up after this many
 bool recursive_backtracking_search () {
 
 //	printf("counter: %d\n", counter);
 
 	// Check if complete
-	if(colors.size() == 51) {
+	if(colors.size() == nodes.size()) {
 		// printf("Completed the colors; returning true!\n");
 		return true;
 	}
@@ -108,7 +134,7 @@ bool recursive_backtracking_search () {
 	map <Node*, int>::iterator it;
 	for(int color = 0; color < 4; color++) {
 
-		counter++;
+		if(++counter > maxCounter) break;
 
 		// Check if color is consistent with immediate neighbors
 		vector <Node*>& neighs = var->neighs;
@@ -140,16 +166,176 @@ bool recursive_backtracking_search () {
 	return false;
 }
 
+/* ********************************************************************************************* */
+double now () {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
+
+/* ********************************************************************************************* */
+/// Solves the problem with the engine and checks the solution it finds. Gives up after
+/// maxAssignments values if it is positive.
+void runEngine (const CSP& csp, const char* name, Propagation p, bool backjumping = false,
+		size_t maxNogoods = 0, long maxAssignments = 0) {
+	Search search (csp, p);
+	search.backjumping = backjumping, search.maxNogoods = maxNogoods;
+	double t0 = now();
+	bool res = search.solve(maxAssignments);
+	double t1 = now();
+	assert(!res || search.valid());
+	printf("%-20s res: %d%s, counter: %ld, backtracks: %ld, backjumps: %ld, nogoods: %ld (hits: %ld), "
+		"%.3lf s\n", name, res, search.gaveUp ? " (gave up)" : "", search.assignments, search.backtracks,
+		search.backjumps, search.nogoodsLearned, search.nogoodHits, t1 - t0);
+}
+
+/* ********************************************************************************************* */
+/// Solves a clustered problem with chronological backtracking, backjumping, backjumping with
+/// nogoods and min-conflicts (which can only find solutions)
+void structuredBenchmark (int numClusters, int size, double degreeIn, double degreeOut, int k,
+		bool planted) {
+	CSP csp (k);
+	if(!clusteredProblem(csp, numClusters, size, degreeIn, degreeOut, planted)) {
+		printf("Can not make the constraints of %d clusters of %d variables\n", numClusters, size);
+		return;
+	}
+	printf("%d variables, %d constraints\n", csp.numVariables(), csp.numEdges());
+	runEngine(csp, "AC-3", AC3, false, 0, maxAssignments);
+	runEngine(csp, "AC-3 + CBJ", AC3, true, 0, maxAssignments);
+	runEngine(csp, "AC-3 + CBJ + nogoods", AC3, true, 10000, maxAssignments);
+	MinConflicts local (csp);
+	double t0 = now();
+	bool res = local.solve(100 * (long) csp.numVariables(), 1);
+	assert(!res || csp.satisfied(local.values));
+	printf("%-20s res: %d, steps: %ld, conflicts left: %zu, %.3lf s\n", "min-conflicts", res, local.steps,
+		local.conflicted.size(), now() - t0);
+}
+
+/* ********************************************************************************************* */
+/// Solves random problems without a planted solution, which are hardest at the average degrees
+/// where about half of them have a solution (near 4.6 for 3 values and 8.7 for 4), one after the
+/// other: with the sequential search, then with the work stealing and the portfolio searches on
+/// 1..maxThreads threads. Checks that they agree and prints the total times and speedups.
+void parallelBenchmark (int n, double degree, int k, int maxThreads, int numProblems) {
+
+	vector <CSP> problems (numProblems, CSP(k));
+	for(int i = 0; i < numProblems; i++) {
+		if(!randomProblem(problems[i], n, degree, false)) {
+			printf("Can not make constraints between %d variables\n", n);
+			return;
+		}
+	}
+
+	// The sequential search
+	vector <bool> expected (numProblems);
+	long assignments = 0;
+	int numSolved = 0;
+	double t0 = now();
+	for(int i = 0; i < numProblems; i++) {
+		Search search (problems[i], AC3);
+		expected[i] = search.solve();
+		assignments += search.assignments, numSolved += expected[i];
+	}
+	double base = now() - t0;
+	printf("%d problems, %d with solutions; sequential: %.3lf s, %ld assignments\n", numProblems, numSolved,
+		base, assignments);
+	printf("%8s %12s %8s %10s %12s %8s %10s\n", "#threads", "stealing s", "speedup", "steals", "portfolio s",
+		"speedup", "restarts");
+
+	for(int t = 1; t <= maxThreads; t++) {
+
+		// Split until there are at least 16 tasks per thread
+		int splitDepth = 1;
+		for(long tasks = k; tasks < 16 * t; tasks *= k) splitDepth++;
+		long steals = 0, restarts = 0;
+		double stealing = 0.0, portfolio = 0.0;
+		for(int i = 0; i < numProblems; i++) {
+			WorkStealing ws (problems[i], t, splitDepth);
+			t0 = now();
+			bool res = ws.solve();
+			stealing += now() - t0;
+			assert(res == expected[i] && (!res || problems[i].satisfied(ws.values)));
+			steals += ws.steals;
+
+			vector <int> values;
+			long runs;
+			t0 = now();
+			res = portfolioSolve(problems[i], t, values, runs, 10 * n);
+			portfolio += now() - t0;
+			assert(res == expected[i] && (!res || problems[i].satisfied(values)));
+			restarts += runs;
+		}
+		printf("%8d %12.3lf %8.2lf %10ld %12.3lf %8.2lf %10ld\n", t, stealing, base / stealing, steals,
+			portfolio, base / portfolio, restarts);
+	}
+}
+
 /* ********************************************************************************************* */
 int main (int argc, char* argv[]) {
 
-	// Create the csp graph
-	readFile();
+	if((argc > 6) && (strcmp(argv[1], "-s") == 0)) {
+		structuredBenchmark(atoi(argv[2]), atoi(argv[3]), atof(argv[4]), atof(argv[5]), atoi(argv[6]),
+			(argc > 7) && (strcmp(argv[7], "planted") == 0));
+		return 0;
+	}
+	if((argc > 6) && (strcmp(argv[1], "-p") == 0)) {
+		parallelBenchmark(atoi(argv[2]), atof(argv[3]), atoi(argv[4]), atoi(argv[5]), atoi(argv[6]));
+		return 0;
+	}
+
+	// Write a random problem
+	if((argc > 5) && (strcmp(argv[1], "-g") == 0)) {
+		CSP csp (atoi(argv[4]));
+		if(!randomProblem(csp, atoi(argv[2]), atof(argv[3]))) {
+			printf("Can not plant a solution with %d values in %s variables\n", csp.numValues, argv[2]);
+			return 1;
+		}
+		bool saved = saveText(csp, argv[5]);
+		assert(saved && "Could not write the file");
+		return 0;
+	}
+
+	// Create the csp graph: the US map, a random problem or one from a file
+	CSP csp (4);
+	bool usMap = (argc < 4);
+	if(usMap) {
+		readFile();
+		loadText(csp, "data.txt");
+	}
+	else if(strcmp(argv[1], "-r") == 0) {
+		csp.numValues = (argc > 4) ? atoi(argv[4]) : 4;
+		if(!randomProblem(csp, atoi(argv[2]), atof(argv[3]))) {
+			printf("Can not plant a solution with %d values in %s variables\n", csp.numValues, argv[2]);
+			return 1;
+		}
+	}
+	else {
+		assert((strcmp(argv[1], "-f") == 0) && "Unknown mode");
+		csp.numValues = atoi(argv[3]);
+		double t0 = now();
+		bool loaded = loadText(csp, argv[2]);
+		assert(loaded && "Could not read the file");
+		printf("%d variables, %d constraints, read in %.3lf s\n", csp.numVariables(), csp.numEdges(), now() - t0);
+	}
+
+	// Perform recursive backtracking search, on the small 4-value problems only
+	long plainCounter = 0;
+	if(csp.numValues == 4 && csp.numVariables() <= 10000) {
+		if(!usMap) makeNodes(csp);
+		srand(time(NULL));
+		double t0 = now();
+		bool res = recursive_backtracking_search ();
+		printf("%-20s res: %d, counter: %ld%s, %.3lf s\n", "backtracking", res, counter,
+			(counter > maxCounter) ? " (gave up)" : "", now() - t0);
+		plainCounter = counter;
+	}
 
-	// Perform recursive backtracking search
-	srand(time(NULL));
-	bool res = recursive_backtracking_search ();
-	printf("res: %d\n", res);
+	// The searches on the domains
+	runEngine(csp, "forward checking", FORWARD_CHECKING, false, 0, maxAssignments);
+	runEngine(csp, "AC-3", AC3, false, 0, maxAssignments);
+	runEngine(csp, "AC-3 + CBJ", AC3, true, 0, maxAssignments);
+	runEngine(csp, "AC-3 + CBJ + nogoods", AC3, true, 10000, maxAssignments);
+	if(!usMap) return 0;
 
 	// Draw the tree
 	FILE* graphFile = fopen("graph.dot", "w+");
@@ -168,6 +354,6 @@ int main (int argc, char* argv[]) {
 	fprintf(graphFile, "overlap=false; \nsplines=true;\n}\n");
 	fclose(graphFile);
 	system("dot -Tpng graph.dot -o graph.png");
-	printf("%d\n", counter);
+	printf("%ld\n", plainCounter);
 }
 /* ********************************************************************************************* */
@@ -0,0 +1,746 @@
+/**
+ * @file csp.h
+ * @author Can Erdogan
+ * @date July 19, 2015
+ * @brief Constraint satisfaction engine for binary "different values" constraints, as in graph
+ * coloring or in putting events that share a resource into different time slots. Variables are
+ * dense integer ids with their neighbors in targets[offsets[i] .. offsets[i+1]), and there can be
+ * any number of values: a domain is a bitset of `words` 64-bit words, all in one flat array. The
+ * search is iterative, with an explicit stack of choices, and undoes its domain changes through a
+ * trail. It can jump back over the choices that did not cause a failure and learn nogoods. For
+ * hard instances, the search tree can be split into tasks for a work-stealing thread pool, or
+ * randomized searches with restarts can race each other; min-conflicts local search is an
+ * alternative for large problems with solutions. Compile with -std=c++11 -pthread.
+ */
+
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../A*/heap.h"
+
+/* ********************************************************************************************* */
+struct CSP {
+
+	int numValues;
+	std::vector <int> offsets;							///< Size n+1, start of the neighbors of each variable
+	std::vector <int> targets;							///< Neighbor ids, grouped by variable
+	std::vector <std::string> names;				///< Optional variable names (text inputs only)
+	std::map <std::string, int> ids;				///< Name to id, only used while parsing
+
+	CSP (int k = 4) : numValues(k), offsets(1, 0) {}
+
+	int numVariables () const { return offsets.size() - 1; }
+	int numEdges () const { return targets.size() / 2; }
+
+	/// Returns the name of the variable, or its id if the problem has no names
+	std::string name (int id) const {
+		if(!names.empty()) return names[id];
+		char buf [16];
+		sprintf(buf, "%d", id);
+		return buf;
+	}
+
+	/// Returns the id of the name, creating a new variable if it is seen for the first time
+	int intern (const char* name) {
+		std::map <std::string, int>::iterator it = ids.find(name);
+		if(it != ids.end()) return it->second;
+		int id = names.size();
+		ids[name] = id;
+		names.push_back(name);
+		return id;
+	}
+
+	/// Builds the adjacency of n variables from constraints given in one or both directions
+	void build (int n, const std::vector <std::pair <int, int> >& edges) {
+		std::vector <std::pair <int, int> > arcs;
+		arcs.reserve(2 * edges.size());
+		for(size_t i = 0; i < edges.size(); i++) {
+			assert(edges[i].first != edges[i].second && "A variable can not differ from itself");
+			arcs.push_back(edges[i]);
+			arcs.push_back(std::make_pair(edges[i].second, edges[i].first));
+		}
+		std::sort(arcs.begin(), arcs.end());
+		arcs.erase(std::unique(arcs.begin(), arcs.end()), arcs.end());
+		offsets.assign(n + 1, 0);
+		targets.resize(arcs.size());
+		for(size_t i = 0; i < arcs.size(); i++) offsets[arcs[i].first + 1]++, targets[i] = arcs[i].second;
+		for(int i = 0; i < n; i++) offsets[i+1] += offsets[i];
+	}
+
+	/// Returns true if the values satisfy every constraint
+	bool satisfied (const std::vector <int>& values) const {
+		for(int i = 0; i < numVariables(); i++) {
+			if(values[i] < 0 || values[i] >= numValues) return false;
+			for(int e = offsets[i]; e < offsets[i+1]; e++) if(values[i] == values[targets[e]]) return false;
+		}
+		return true;
+	}
+};
+
+/* ********************************************************************************************* */
+/// Parses the format of data.txt: a line per variable with its name and then the names of the
+/// variables it must differ from, separated by any of " |{},[]"
+bool loadText (CSP& csp, const char* fileName) {
+	std::ifstream file (fileName);
+	if(!file.is_open()) return false;
+	std::vector <std::pair <int, int> > edges;
+	std::string line;
+	while(std::getline(file, line)) {
+		std::vector <char> buf (line.begin(), line.end());
+		buf.push_back(0);
+		char* p = strtok(&buf[0], " \t\r|{},[]");
+		if(p == NULL) continue;
+		int var = csp.intern(p);
+		while((p = strtok(NULL, " \t\r|{},[]")) != NULL) edges.push_back(std::make_pair(var, csp.intern(p)));
+	}
+	csp.build(csp.names.size(), edges);
+	return true;
+}
+
+/// Writes the problem in the format of data.txt
+bool saveText (const CSP& csp, const char* fileName) {
+	FILE* file = fopen(fileName, "w");
+	if(file == NULL) return false;
+	for(int i = 0; i < csp.numVariables(); i++) {
+		fprintf(file, "%s", csp.name(i).c_str());
+		for(int e = csp.offsets[i]; e < csp.offsets[i+1]; e++) fprintf(file, " %s", csp.name(csp.targets[e]).c_str());
+		fprintf(file, "\n");
+	}
+	fclose(file);
+	return true;
+}
+
+/* ********************************************************************************************* */
+/// Creates n variables with the given average degree. If planted, the constraints only join
+/// variables with different hidden values, so that a solution with csp.numValues values exists.
+/// Returns false, with no constraints, if no pair of variables can be joined (fewer than two
+/// variables, or fewer than two different hidden values) while the degree asks for some.
+bool randomProblem (CSP& csp, int n, double degree, bool planted = true) {
+	std::vector <int> hidden (std::max(n, 0), 0);
+	for(int i = 0; planted && (csp.numValues > 0) && i < n; i++) hidden[i] = rand() % csp.numValues;
+	bool joinable = (n > 1) && (!planted || (std::count(hidden.begin(), hidden.end(), hidden[0]) < n));
+	std::vector <std::pair <int, int> > edges;
+	long numEdges = joinable ? (long) (degree * n / 2) : 0;
+	while((long) edges.size() < numEdges) {
+		int a = rand() % n, b = rand() % n;
+		if((a != b) && (!planted || hidden[a] != hidden[b])) edges.push_back(std::make_pair(a, b));
+	}
+	csp.names.clear();
+	csp.build(std::max(n, 0), edges);
+	return joinable || (degree * n / 2 < 1);
+}
+
+/// Creates clusters of variables with dense constraints inside and sparse ones between them, as
+/// in structured problems: a failure inside a cluster has nothing to do with the choices made in
+/// the others. The solution is planted if asked. Returns false if some of the constraints can not
+/// be made (as in randomProblem), leaving them out.
+bool clusteredProblem (CSP& csp, int numClusters, int size, double degreeIn, double degreeOut,
+		bool planted = true) {
+	numClusters = std::max(numClusters, 0), size = std::max(size, 0);
+	int n = numClusters * size;
+	std::vector <int> hidden (n, 0);
+	for(int i = 0; planted && (csp.numValues > 0) && i < n; i++) hidden[i] = rand() % csp.numValues;
+	std::vector <std::pair <int, int> > edges;
+	long inside = (long) (degreeIn * size / 2), between = (long) (degreeOut * n / 2);
+	bool complete = true;
+	for(int c = 0; c < numClusters; c++) {
+		std::vector <int>::iterator first = hidden.begin() + c * size, last = first + size;
+		if((size < 2) || (planted && (std::count(first, last, *first) == size))) {
+			complete = complete && (inside == 0);
+			continue;
+		}
+		for(long i = 0; i < inside; ) {
+			int a = c * size + rand() % size, b = c * size + rand() % size;
+			if((a != b) && (!planted || hidden[a] != hidden[b])) edges.push_back(std::make_pair(a, b)), i++;
+		}
+	}
+	if((numClusters < 2) || (planted && (std::count(hidden.begin(), hidden.end(), hidden[0]) == n))) {
+		complete = complete && (between == 0);
+		between = 0;
+	}
+	for(long i = 0; i < between; ) {
+		int a = rand() % n, b = rand() % n;
+		if((a / size != b / size) && (!planted || hidden[a] != hidden[b])) edges.push_back(std::make_pair(a, b)), i++;
+	}
+	csp.names.clear();
+	csp.build(n, edges);
+	return complete;
+}
+
+/* ********************************************************************************************* */
+enum Propagation { FORWARD_CHECKING, AC3 };
+
+/// Backtracking search over the domains. The next variable has the fewest values left (MRV), ties
+/// going to the most unassigned neighbors (degree), kept in an indexed heap as the domains shrink.
+/// Every assignment is propagated: forward checking removes the value from the neighbors, and
+/// AC-3 also revises the arcs into every variable left with a single value. For "different"
+/// constraints, revising (y, x) only removes the last value of x from y, so the queue of arcs is
+/// a queue of such variables. A search can be randomized, breaking the ties between variables and
+/// ordering the values at random, and stopped from another thread.
+/// With backjumping (FC-CBJ, Prosser), every removed value remembers its cause: an assignment, or a
+/// variable left with a single value, whose own removals explain it in turn. The conflict set of
+/// a level collects the levels that explain its failures; when its values run out, the search
+/// jumps back to the deepest level of the set, which inherits the rest, instead of to the level
+/// above. The set is also a nogood: those assignments can not hold together, and a bounded store
+/// of the short ones cuts the same failure short when it comes back elsewhere in the tree.
+struct Search {
+
+	/// A domain word before a change
+	struct Change {
+		int var, word;
+		uint64_t old;
+	};
+
+	/// A variable on the stack of choices and the position of its value in the value order
+	struct Frame {
+		int var, pos;
+		size_t mark;												///< Trail size before the value was assigned
+	};
+
+	const CSP& csp;
+	Propagation propagation;
+	int words;														///< 64-bit words per domain
+	std::vector <uint64_t> domains;				///< (variable, word)
+	std::vector <int> sizes;							///< Values left in each domain
+	std::vector <int> degrees;						///< Unassigned neighbors of each variable
+	std::vector <int> values;							///< Assigned value of each variable, -1 if none
+	std::vector <Change> trail;
+	std::vector <Frame> stack;
+	std::vector <int> queue;							///< The AC-3 queue
+	IndexedHeap <4, int64_t> order;				///< The unassigned variables by (size, -degree, tie)
+	std::vector <int> ties;								///< Random tie-breaks of the variables, if randomized
+	std::vector <int> valueOrder;					///< The order to try the values in, if not ascending
+	const std::atomic <bool>* stop;				///< Set from outside to stop the search, if given
+	long assignments;											///< Values tried
+	long backtracks;											///< Variables whose values all failed
+	bool gaveUp;													///< If the last run() hit its limit or was stopped
+
+	static const size_t maxNogoodSize = 8;
+	bool backjumping;											///< Jump back to the cause of a failure
+	size_t maxNogoods;										///< Capacity of the nogood store, 0 for none (needs backjumping)
+	std::vector <int> levels;							///< Stack depth of each assignment, 0 for those before run()
+	std::vector <int> causes;							///< (variable, value): who removed it, x if x was assigned, ~x if
+																				///< x was left with a single value
+	std::vector <std::vector <int> > conflictSets;	///< The levels that caused the failures of each level
+	std::vector <int> conflict;						///< The levels that caused the last failure of assign()
+	std::vector <int> visited;						///< The variables already explained, by stamp
+	int stamp;
+	std::vector <std::pair <int, int> > toExplain;
+	std::vector <std::vector <std::pair <int, int> > > nogoods;	///< A ring of (variable, value) sets
+	size_t nextNogood;										///< The slot to overwrite when the ring is full
+	std::vector <std::vector <int> > watches;	///< The nogoods with each variable
+	long backjumps;												///< Failures that went back more than one level
+	long nogoodsLearned, nogoodHits;
+
+	Search (const CSP& c, Propagation p = AC3) : csp(c), propagation(p), words((c.numValues + 63) / 64),
+		stop(NULL), backjumping(false), maxNogoods(0) {}
+
+	inline int64_t key (int var) const {
+		return (((int64_t) sizes[var]) << 48) - (((int64_t) degrees[var]) << 24) + (ties.empty() ? 0 : ties[var]);
+	}
+
+	/// Draws new tie-breaks and a new value order
+	void randomize (unsigned seed) {
+		ties.resize(csp.numVariables());
+		for(size_t i = 0; i < ties.size(); i++) ties[i] = rand_r(&seed) & 0xFFFFFF;
+		valueOrder.resize(csp.numValues);
+		for(int i = 0; i < csp.numValues; i++) valueOrder[i] = i;
+		for(int i = csp.numValues - 1; i > 0; i--) std::swap(valueOrder[i], valueOrder[rand_r(&seed) % (i + 1)]);
+	}
+
+	inline bool contains (int var, int value) const {
+		return (domains[(size_t) var * words + value / 64] >> (value % 64)) & 1;
+	}
+
+	/// Returns the first value of the domain at or after the given one, -1 if none
+	int nextValue (int var, int from) const {
+		const uint64_t* d = &domains[(size_t) var * words];
+		for(int w = from / 64; w < words; w++) {
+			uint64_t bits = d[w];
+			if(w == from / 64) bits &= ~0ULL << (from % 64);
+			if(bits) return 64 * w + __builtin_ctzll(bits);
+		}
+		return -1;
+	}
+
+	/// Returns the value after the given position in the value order and moves the position to it,
+	/// -1 if none is left in the domain. Positions start at -1.
+	int nextChoice (int var, int& pos) const {
+		if(valueOrder.empty()) return pos = nextValue(var, pos + 1);
+		while(++pos < csp.numValues) if(contains(var, valueOrder[pos])) return valueOrder[pos];
+		return -1;
+	}
+
+	/// Removes a value from the domain. Returns false if the domain is left empty.
+	inline bool prune (int var, int value, int cause) {
+		uint64_t& word = domains[(size_t) var * words + value / 64];
+		uint64_t bit = 1ULL << (value % 64);
+		if(!(word & bit)) return true;
+		Change change = {var, value / 64, word};
+		trail.push_back(change);
+		word &= ~bit;
+		if(backjumping) causes[(size_t) var * csp.numValues + value] = cause;
+		if(--sizes[var] == 0) return false;
+		if(order.contains(var)) order.update(var, key(var));
+		return true;
+	}
+
+	/// Restores the domains changed since the trail had the given size
+	void undo (size_t mark) {
+		while(trail.size() > mark) {
+			const Change& change = trail.back();
+			uint64_t& word = domains[(size_t) change.var * words + change.word];
+			sizes[change.var] += __builtin_popcountll(change.old) - __builtin_popcountll(word);
+			word = change.old;
+			if(order.contains(change.var)) order.update(change.var, key(change.var));
+			trail.pop_back();
+		}
+	}
+
+	/// Adds to conflict the levels of the assignments that removed the values of the variable other
+	/// than keep (-1 for all), following the variables left with a single value back to them
+	void explain (int var, int keep) {
+		stamp++;
+		toExplain.clear();
+		toExplain.push_back(std::make_pair(var, keep));
+		visited[var] = stamp;
+		while(!toExplain.empty()) {
+			int x = toExplain.back().first, kept = toExplain.back().second;
+			toExplain.pop_back();
+			for(int u = 0; u < csp.numValues; u++) {
+				if(u == kept || contains(x, u)) continue;
+				int cause = causes[(size_t) x * csp.numValues + u];
+				if(cause >= 0) {
+					if(levels[cause] > 0) conflict.push_back(levels[cause]);
+				}
+				else if(visited[~cause] != stamp) {
+					visited[~cause] = stamp;
+					toExplain.push_back(std::make_pair(~cause, nextValue(~cause, 0)));
+				}
+			}
+		}
+	}
+
+	/// Returns true if the assignment completes a nogood, with the levels of the others in conflict
+	bool violatesNogood (int var, int value) {
+		const std::vector <int>& ids = watches[var];
+		for(size_t i = 0; i < ids.size(); i++) {
+			const std::vector <std::pair <int, int> >& nogood = nogoods[ids[i]];
+			bool holds = true;
+			for(size_t j = 0; holds && j < nogood.size(); j++)
+				holds = (nogood[j].first == var) ? (nogood[j].second == value) : (values[nogood[j].first] == nogood[j].second);
+			if(!holds) continue;
+			for(size_t j = 0; j < nogood.size(); j++)
+				if(nogood[j].first != var && levels[nogood[j].first] > 0) conflict.push_back(levels[nogood[j].first]);
+			nogoodHits++;
+			return true;
+		}
+		return false;
+	}
+
+	/// Stores the assignments of the levels as a nogood, replacing the oldest one if the store is full
+	void learn (const std::vector <int>& set) {
+		if(maxNogoods == 0 || set.empty() || set.size() > maxNogoodSize) return;
+		size_t id = nogoods.size();
+		if(id < maxNogoods) nogoods.push_back(std::vector <std::pair <int, int> > ());
+		else {
+			id = nextNogood, nextNogood = (nextNogood + 1) % maxNogoods;
+			for(size_t j = 0; j < nogoods[id].size(); j++) {
+				std::vector <int>& ids = watches[nogoods[id][j].first];
+				ids.erase(std::find(ids.begin(), ids.end(), (int) id));
+			}
+		}
+		std::vector <std::pair <int, int> >& nogood = nogoods[id];
+		nogood.clear();
+		for(size_t i = 0; i < set.size(); i++) {
+			int var = stack[set[i] - 1].var;
+			nogood.push_back(std::make_pair(var, values[var]));
+			watches[var].push_back(id);
+		}
+		nogoodsLearned++;
+	}
+
+	/// Reduces the domain to the value and propagates it. Returns false on a wipe-out or a nogood,
+	/// with the levels that caused it in conflict if backjumping.
+	bool assign (int var, int value) {
+		if(maxNogoods > 0 && violatesNogood(var, value)) return false;
+		for(int w = 0; w < words; w++) {
+			uint64_t& word = domains[(size_t) var * words + w];
+			uint64_t keep = (w == value / 64) ? (1ULL << (value % 64)) : 0;
+			if(word == keep) continue;
+			if(backjumping) {
+				for(uint64_t bits = word & ~keep; bits; bits &= bits - 1)
+					causes[(size_t) var * csp.numValues + 64 * w + __builtin_ctzll(bits)] = var;
+			}
+			Change change = {var, w, word};
+			trail.push_back(change);
+			word = keep;
+		}
+		sizes[var] = 1;
+		queue.clear();
+		queue.push_back(var);
+		for(size_t i = 0; i < queue.size(); i++) {
+			int x = queue[i], v = (x == var) ? value : nextValue(x, 0);
+			for(int e = csp.offsets[x]; e < csp.offsets[x+1]; e++) {
+				int y = csp.targets[e], size = sizes[y];
+				if(!prune(y, v, (x == var) ? x : ~x)) {
+					if(backjumping) explain(y, -1);
+					return false;
+				}
+				if(propagation == AC3 && size == 2 && sizes[y] == 1 && values[y] == -1) queue.push_back(y);
+			}
+			if(propagation == FORWARD_CHECKING) break;
+		}
+		return true;
+	}
+
+	/// Changes the unassigned degrees of the neighbors as the variable is assigned or released
+	void updateDegrees (int var, int delta) {
+		for(int e = csp.offsets[var]; e < csp.offsets[var+1]; e++) {
+			int y = csp.targets[e];
+			degrees[y] += delta;
+			if(order.contains(y)) order.update(y, key(y));
+		}
+	}
+
+	/// Makes every value possible and every variable unassigned
+	void reset () {
+		int n = csp.numVariables();
+		domains.assign((size_t) n * words, ~0ULL);
+		if(csp.numValues % 64) {
+			for(int i = 0; i < n; i++) domains[(size_t) i * words + words - 1] = (1ULL << (csp.numValues % 64)) - 1;
+		}
+		sizes.assign(n, csp.numValues);
+		values.assign(n, -1);
+		degrees.resize(n);
+		order = IndexedHeap <4, int64_t> (n);
+		for(int i = 0; i < n; i++) {
+			degrees[i] = csp.offsets[i+1] - csp.offsets[i];
+			if(csp.numValues > 0) order.push(i, key(i));
+		}
+		trail.clear(), stack.clear();
+		assignments = backtracks = 0;
+		gaveUp = false;
+		levels.assign(n, 0);
+		if(backjumping) {
+			causes.resize((size_t) n * csp.numValues);
+			visited.assign(n, 0);
+			stamp = 0;
+		}
+		nogoods.clear();
+		nextNogood = 0;
+		if(maxNogoods > 0) watches.assign(n, std::vector <int> ());
+		backjumps = nogoodsLearned = nogoodHits = 0;
+	}
+
+	/// Assigns an unassigned variable for good: run() will not undo it. Returns false if the value
+	/// is not in its domain or its propagation empties a domain.
+	bool decide (int var, int value) {
+		assert(order.contains(var));
+		if(!contains(var, value)) return false;
+		order.remove(var);
+		updateDegrees(var, -1);
+		values[var] = value;
+		assignments++;
+		conflict.clear();
+		return assign(var, value);
+	}
+
+	/// Releases the deepest variable, whose values all failed, and goes back to the level above or,
+	/// with backjumping, to the deepest level of its conflict set, which inherits the rest of the
+	/// set. Returns false if there is no level to go back to.
+	bool backtrack () {
+		int depth = stack.size(), target = depth - 1;
+		if(backjumping) {
+
+			// The failures of the values and the removals before the variable was chosen
+			std::vector <int>& set = conflictSets[depth - 1];
+			conflict.clear();
+			explain(stack.back().var, -1);
+			set.insert(set.end(), conflict.begin(), conflict.end());
+			std::sort(set.begin(), set.end());
+			set.erase(std::unique(set.begin(), set.end()), set.end());
+			while(!set.empty() && set.back() >= depth) set.pop_back();
+			target = set.empty() ? 0 : set.back();
+			learn(set);
+			if(target < depth - 1) backjumps++;
+			if(target > 0) conflictSets[target - 1].insert(conflictSets[target - 1].end(), set.begin(), set.end() - 1);
+		}
+		while((int) stack.size() > target) {
+			const Frame& frame = stack.back();
+			undo(frame.mark);
+			values[frame.var] = -1;
+			updateDegrees(frame.var, 1);
+			order.push(frame.var, key(frame.var));
+			stack.pop_back();
+			backtracks++;
+		}
+		return !stack.empty();
+	}
+
+	/// Searches from the current state for a solution into values. Gives up after maxAssignments
+	/// values if it is positive, or when stop is set.
+	bool run (long maxAssignments = 0) {
+
+		gaveUp = false;
+		if(csp.numValues == 0) return csp.numVariables() == 0;
+		while(!order.empty()) {
+
+			// Choose the next variable
+			Frame frame = {order.pop(), -1, trail.size()};
+			stack.push_back(frame);
+			updateDegrees(frame.var, -1);
+			if(backjumping) {
+				if(conflictSets.size() < stack.size()) conflictSets.resize(stack.size());
+				conflictSets[stack.size() - 1].clear();
+			}
+
+			// Try the next value of the deepest choice, going up when there is none left
+			while(!stack.empty()) {
+				Frame& top = stack.back();
+				undo(top.mark);
+				int value = nextChoice(top.var, top.pos);
+				if(value != -1 && ((maxAssignments > 0 && assignments >= maxAssignments) ||
+						(stop != NULL && stop->load(std::memory_order_relaxed)))) {
+					gaveUp = true;
+					return false;
+				}
+				if(value == -1) {
+					if(!backtrack()) return false;
+					continue;
+				}
+				assignments++;
+				values[top.var] = value;
+				levels[top.var] = stack.size();
+				conflict.clear();
+				if(assign(top.var, value)) break;
+				if(backjumping) {
+					std::vector <int>& set = conflictSets[stack.size() - 1];
+					set.insert(set.end(), conflict.begin(), conflict.end());
+				}
+			}
+			if(stack.empty()) return false;
+		}
+		return true;
+	}
+
+	/// Looks for a solution into values; gives up after maxAssignments values if it is positive
+	bool solve (long maxAssignments = 0) {
+		reset();
+		return run(maxAssignments);
+	}
+
+	/// Returns true if the values satisfy every constraint
+	bool valid () const { return csp.satisfied(values); }
+};
+
+/* ********************************************************************************************* */
+/// Min-conflicts local search (Minton et al.): starts from random values and moves a random
+/// variable in conflict to the value that conflicts with the fewest neighbors, ties broken at
+/// random; with a small probability, to a random value to get off plateaus. counts[x * k + v] is
+/// the number of neighbors of x with value v, so a move costs the degree of the variable. Can
+/// only find solutions, not show there are none.
+struct MinConflicts {
+
+	const CSP& csp;
+	std::vector <int> values;
+	std::vector <int> counts;							///< (variable, value): neighbors with the value
+	std::vector <int> conflicted;					///< The variables in conflict
+	std::vector <int> where;							///< Position of each variable in conflicted, -1 if none
+	long steps;
+
+	MinConflicts (const CSP& c) : csp(c) {}
+
+	/// Adds or removes the variable from the conflicted ones after its counts changed
+	void refresh (int var) {
+		bool bad = counts[(size_t) var * csp.numValues + values[var]] > 0;
+		if(bad && where[var] == -1) where[var] = conflicted.size(), conflicted.push_back(var);
+		else if(!bad && where[var] != -1) {
+			int last = conflicted.back();
+			conflicted[where[var]] = last, where[last] = where[var];
+			conflicted.pop_back(), where[var] = -1;
+		}
+	}
+
+	/// Gives the variable a new value and updates the counts of its neighbors
+	void move (int var, int value) {
+		int k = csp.numValues, old = values[var];
+		values[var] = value;
+		for(int e = csp.offsets[var]; e < csp.offsets[var+1]; e++) {
+			int y = csp.targets[e];
+			counts[(size_t) y * k + old]--, counts[(size_t) y * k + value]++;
+			refresh(y);
+		}
+		refresh(var);
+	}
+
+	/// Looks for a solution into values in at most maxSteps moves
+	bool solve (long maxSteps, unsigned seed, double noise = 0.02) {
+		int n = csp.numVariables(), k = csp.numValues;
+		if(k == 0) return n == 0;
+		values.resize(n);
+		for(int i = 0; i < n; i++) values[i] = rand_r(&seed) % k;
+		counts.assign((size_t) n * k, 0);
+		for(int i = 0; i < n; i++) {
+			for(int e = csp.offsets[i]; e < csp.offsets[i+1]; e++) counts[(size_t) i * k + values[csp.targets[e]]]++;
+		}
+		conflicted.clear();
+		where.assign(n, -1);
+		for(int i = 0; i < n; i++) refresh(i);
+
+		std::vector <int> best;
+		for(steps = 0; steps < maxSteps && !conflicted.empty(); steps++) {
+			int var = conflicted[rand_r(&seed) % conflicted.size()];
+			if(rand_r(&seed) < noise * RAND_MAX) {
+				move(var, rand_r(&seed) % k);
+				continue;
+			}
+			best.clear();
+			const int* c = &counts[(size_t) var * k];
+			for(int v = 0; v < k; v++) {
+				if(best.empty() || c[v] < c[best[0]]) best.assign(1, v);
+				else if(c[v] == c[best[0]]) best.push_back(v);
+			}
+			move(var, best[rand_r(&seed) % best.size()]);
+		}
+		return conflicted.empty();
+	}
+};
+
+/* ********************************************************************************************* */
+/// Parallel search: the tree is split into tasks, each a list of decisions, down to splitDepth
+/// decisions; the deeper subtrees are searched whole. Each thread pops the newest task of its own
+/// deque and, when it is empty, steals the oldest (and so largest) task of another thread. The
+/// first solution stops every thread. Returns true with the solution in values, false if there
+/// is none.
+struct WorkStealing {
+
+	typedef std::vector <std::pair <int, int> > Task;
+
+	const CSP& csp;
+	int numThreads, splitDepth;
+	std::vector <std::deque <Task> > queues;
+	std::vector <std::mutex> locks;
+	std::atomic <bool> found;
+	std::atomic <long> pending;							///< Tasks pushed and not yet finished
+	std::atomic <long> tasks, steals;
+	std::vector <int> values;
+
+	WorkStealing (const CSP& c, int t, int d) : csp(c), numThreads(t), splitDepth(d), queues(t), locks(t) {}
+
+	/// Takes the newest task of the thread, or else the oldest one of another thread
+	bool take (int t, Task& task) {
+		for(int i = 0; i < numThreads; i++) {
+			int q = (t + i) % numThreads;
+			std::lock_guard <std::mutex> lock (locks[q]);
+			if(queues[q].empty()) continue;
+			if(i == 0) task.swap(queues[q].back()), queues[q].pop_back();
+			else task.swap(queues[q].front()), queues[q].pop_front(), steals++;
+			return true;
+		}
+		return false;
+	}
+
+	void push (int t, Task& task) {
+		pending++, tasks++;
+		std::lock_guard <std::mutex> lock (locks[t]);
+		queues[t].push_back(Task());
+		queues[t].back().swap(task);
+	}
+
+	void work (int t) {
+		Search search (csp, AC3);
+		search.stop = &found;
+		Task task, child;
+		while(!found.load() && pending.load() > 0) {
+			if(!take(t, task)) {
+				std::this_thread::yield();
+				continue;
+			}
+
+			// Replay the decisions of the task, then split it further or search its subtree
+			search.reset();
+			bool consistent = true, solved = false;
+			for(size_t i = 0; consistent && i < task.size(); i++)
+				consistent = search.decide(task[i].first, task[i].second);
+			if(consistent && search.order.empty()) solved = true;
+			else if(consistent && (int) task.size() < splitDepth) {
+				int var = search.order.top();
+				for(int pos = -1, value; (value = search.nextChoice(var, pos)) != -1; ) {
+					child = task;
+					child.push_back(std::make_pair(var, value));
+					push(t, child);
+				}
+			}
+			else if(consistent) solved = search.run();
+			if(solved && !found.exchange(true)) values = search.values;
+			pending--;
+		}
+	}
+
+	bool solve () {
+		found = false;
+		pending = tasks = steals = 0;
+		Task root;
+		push(0, root);
+		std::vector <std::thread> threads;
+		for(int t = 0; t < numThreads; t++) threads.push_back(std::thread(&WorkStealing::work, this, t));
+		for(int t = 0; t < numThreads; t++) threads[t].join();
+		for(int t = 0; t < numThreads; t++) queues[t].clear();
+		return found;
+	}
+};
+
+/* ********************************************************************************************* */
+/// The Luby sequence 1 1 2 1 1 2 4 1 1 2 1 1 2 4 8 ..., for i >= 1
+long luby (long i) {
+	int k = 1;
+	while((1L << k) - 1 < i) k++;
+	if(i == (1L << k) - 1) return 1L << (k - 1);
+	return luby(i - (1L << (k - 1)) + 1);
+}
+
+/// Portfolio: the first thread runs the plain search to the end, so that problems without a
+/// solution take no longer than alone; the others run differently randomized searches, restarting
+/// after unit * luby(i) values. The first search to finish stops the others. Returns true with the
+/// solution in values; restarts is the number of runs that used up their values.
+bool portfolioSolve (const CSP& csp, int numThreads, std::vector <int>& values, long& restarts, long unit) {
+	std::atomic <bool> done (false), solved (false);
+	std::atomic <long> limited (0);
+	std::vector <std::thread> threads;
+	for(int t = 0; t < numThreads; t++) {
+		threads.push_back(std::thread([&, t] () {
+			Search search (csp, AC3);
+			search.stop = &done;
+			for(long i = 1; !done.load(); i++) {
+				if(t > 0) search.randomize(1000003u * t + i);
+				long limit = (t == 0) ? 0 : unit * luby(i);
+				bool res = search.solve(limit);
+
+				// Only the runs that used up their values restart; the others were stopped
+				if(search.gaveUp) {
+					if((limit > 0) && (search.assignments >= limit)) limited++;
+					continue;
+				}
+				if(!done.exchange(true)) {
+					solved = res;
+					if(res) values = search.values;
+				}
+			}
+		}));
+	}
+	for(int t = 0; t < numThreads; t++) threads[t].join();
+	restarts = limited;
+	return solved;
+}
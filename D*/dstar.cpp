@@ -0,0 +1,337 @@
+/**
+ * @file dstar.cpp
+ * @author Can Erdogan
+ * @date July 12, 2015
+ * @brief Implementation of D* Lite (Koenig & Likhachev, 2002), the incremental version of the
+ * D* replanner (see icra94.ps), on the CSR graph of the A* implementation. The search runs
+ * backwards from the goal so that when edge costs change, only the part of the search tree
+ * whose costs are affected is repaired instead of planning from scratch.
+ * Usage: ./a.out                       (Bucharest to Arad on the Romania map, then roads close
+ *                                       while the robot drives)
+ *        ./a.out -b <rows> <cols>      (replanning vs. A* benchmark on a random grid)
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <vector>
+#include "../A*/graph.h"
+#include "../A*/heap.h"
+
+using namespace std;
+
+Graph graph;
+int gridCols = 0;											///< Width of the benchmark grid, for its heuristic
+
+/* ******************************************************************************************** */
+/// A lower bound on the road distance between two cities from the straight-line distances of
+/// data.txt, which are only to Bucharest: by the triangle inequality, two cities are at least as
+/// far apart as the difference of their distances to it. Exact for Bucharest itself, so it is
+/// the usual straight-line distance while the robot is there, and still admissible (and
+/// consistent) after moveTo() takes the robot elsewhere.
+double straightLine (int a, int b) { return fabs(graph.heuristic[a] - graph.heuristic[b]); }
+
+/// Manhattan distance on the benchmark grid; admissible since every edge is at least 1 long
+double manhattan (int a, int b) {
+	return abs(a / gridCols - b / gridCols) + abs(a % gridCols - b % gridCols);
+}
+
+double (*heuristic) (int, int) = straightLine;
+
+/* ******************************************************************************************** */
+/// Priority of a node, compared lexicographically
+struct Key {
+	double k1, k2;
+	Key () {}
+	Key (double a, double b) : k1(a), k2(b) {}
+	bool operator< (const Key& o) const { return (k1 < o.k1) || ((k1 == o.k1) && (k2 < o.k2)); }
+};
+
+/* ******************************************************************************************** */
+struct DStarLite {
+
+	int start, goal;
+	int last;															///< Start at the time km was last updated
+	double km;														///< Heuristic offset accumulated as the robot moves
+	vector <double> g;										///< Cost-to-goal estimates
+	vector <double> rhs;									///< One-step lookahead values of g
+	IndexedHeap <4, Key> open;						///< Locally inconsistent nodes (g != rhs)
+	long expanded;												///< Nodes popped from the open list so far
+
+	/* ****************************************************************************************** */
+	void init (int s, int t) {
+		start = last = s, goal = t;
+		km = 0.0;
+		expanded = 0;
+		g.assign(graph.numNodes(), INFINITY);
+		rhs.assign(graph.numNodes(), INFINITY);
+		open = IndexedHeap <4, Key> (graph.numNodes());
+		rhs[goal] = 0.0;
+		open.push(goal, calculateKey(goal));
+	}
+
+	/* ****************************************************************************************** */
+	inline Key calculateKey (int v) const {
+		double m = min(g[v], rhs[v]);
+		return Key(m + heuristic(start, v) + km, m);
+	}
+
+	/* ****************************************************************************************** */
+	/// Returns the best rhs value for v from its successors
+	double bestSucc (int v) const {
+		double best = INFINITY;
+		for(int e = graph.offsets[v]; e < graph.offsets[v+1]; e++)
+			best = min(best, graph.weights[e] + g[graph.targets[e]]);
+		return best;
+	}
+
+	/* ****************************************************************************************** */
+	/// Puts the node into the open list with its current key if it is inconsistent; else removes it
+	void updateVertex (int v) {
+		bool inOpen = open.contains(v);
+		if(g[v] != rhs[v]) {
+			if(inOpen) open.update(v, calculateKey(v));
+			else open.push(v, calculateKey(v));
+		}
+		else if(inOpen) open.remove(v);
+	}
+
+	/* ****************************************************************************************** */
+	void computeShortestPath () {
+
+		while(!open.empty() && (open.topKey() < calculateKey(start) || rhs[start] > g[start])) {
+
+			int u = open.top();
+			Key kold = open.topKey(), knew = calculateKey(u);
+			expanded++;
+
+			// The key is outdated since the robot moved; reinsert with the new one
+			if(kold < knew) open.update(u, knew);
+
+			// Overconsistent: the cost decreased, make it consistent and propagate to predecessors
+			else if(g[u] > rhs[u]) {
+				g[u] = rhs[u];
+				open.remove(u);
+				for(int e = graph.offsets[u]; e < graph.offsets[u+1]; e++) {
+					int s = graph.targets[e];
+					if(s != goal) rhs[s] = min(rhs[s], graph.weights[e] + g[u]);
+					updateVertex(s);
+				}
+			}
+
+			// Underconsistent: the cost increased, invalidate and let the predecessors that relied
+			// on it look for another successor
+			else {
+				double gold = g[u];
+				g[u] = INFINITY;
+				for(int e = graph.offsets[u]; e < graph.offsets[u+1]; e++) {
+					int s = graph.targets[e];
+					if(s != goal && rhs[s] == graph.weights[e] + gold) rhs[s] = bestSucc(s);
+					updateVertex(s);
+				}
+				if(u != goal) rhs[u] = bestSucc(u);
+				updateVertex(u);
+			}
+		}
+	}
+
+	/* ****************************************************************************************** */
+	/// Moves the robot; the keys in the open list are lazily corrected through km
+	void moveTo (int s) {
+		km += heuristic(last, s);
+		last = start = s;
+	}
+
+	/* ****************************************************************************************** */
+	/// Changes the length of the undirected edge (u,v). Call replan() after a batch of changes.
+	void updateEdge (int u, int v, float w) {
+		int e = graph.findEdge(u, v);
+		assert(e != -1);
+		double old = graph.weights[e];
+		graph.setWeight(u, v, w);
+		int ends [2][2] = {{u, v}, {v, u}};
+		for(int i = 0; i < 2; i++) {
+			int a = ends[i][0], b = ends[i][1];
+			if(a == goal) continue;
+			if(old > w) rhs[a] = min(rhs[a], w + g[b]);
+			else if(rhs[a] == old + g[b]) rhs[a] = bestSucc(a);
+			updateVertex(a);
+		}
+	}
+
+	/* ****************************************************************************************** */
+	void replan () { computeShortestPath(); }
+
+	/* ****************************************************************************************** */
+	/// Cost of the current plan. The search stops once the start is overconsistent, so its rhs
+	/// (not its g) holds the path cost.
+	double cost () const { return rhs[start]; }
+
+	/* ****************************************************************************************** */
+	/// Returns the current path from the start to the goal by following the best successors
+	bool path (vector <int>& nodes) const {
+		nodes.clear();
+		if(cost() == INFINITY) return false;
+		for(int curr = start; curr != goal; ) {
+			nodes.push_back(curr);
+			int best = -1;
+			double bestCost = INFINITY;
+			for(int e = graph.offsets[curr]; e < graph.offsets[curr+1]; e++) {
+				double cost = graph.weights[e] + g[graph.targets[e]];
+				if(cost < bestCost) bestCost = cost, best = graph.targets[e];
+			}
+			if(best == -1 || nodes.size() > (size_t) graph.numNodes()) return false;
+			curr = best;
+		}
+		nodes.push_back(goal);
+		return true;
+	}
+};
+
+/* ******************************************************************************************** */
+/// Plain A* from scratch towards the goal with the same heuristic, for comparison
+double astar (int start, int goal, long& expanded) {
+	int n = graph.numNodes();
+	vector <double> cost (n, INFINITY);
+	vector <bool> closed (n, false);
+	IndexedHeap <4> open (n);
+	cost[start] = 0.0;
+	open.push(start, heuristic(goal, start));
+	while(!open.empty()) {
+		int current = open.pop();
+		expanded++;
+		if(current == goal) return cost[goal];
+		closed[current] = true;
+		for(int e = graph.offsets[current]; e < graph.offsets[current+1]; e++) {
+			int neigh = graph.targets[e];
+			double c = cost[current] + graph.weights[e];
+			if(closed[neigh] || c >= cost[neigh]) continue;
+			cost[neigh] = c;
+			double f = c + heuristic(goal, neigh);
+			if(open.contains(neigh)) open.decreaseKey(neigh, f);
+			else open.push(neigh, f);
+		}
+	}
+	return INFINITY;
+}
+
+/* ******************************************************************************************** */
+double now () {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
+
+/* ******************************************************************************************** */
+void printPath (const DStarLite& dstar) {
+	vector <int> nodes;
+	if(!dstar.path(nodes)) {
+		printf("No path.\n");
+		return;
+	}
+	printf("Path! Cost: %lf, expanded so far: %ld\n", dstar.cost(), dstar.expanded);
+	for(size_t i = 0; i < nodes.size(); i++) printf("%s\n", graph.name(nodes[i]).c_str());
+}
+
+/* ******************************************************************************************** */
+/// Moves the robot a step along its path on a grid and changes k edges next to the rest of it (the
+/// robot "senses" new costs around its route), and compares repairing the D* Lite search with
+/// running A* again from where the robot is, over a few trials.
+void benchmark (int rows, int cols) {
+
+	// Create the grid and plan from one corner to the other
+	vector <Edge> edges;
+	makeGrid(rows, cols, edges);
+	graph.build(rows * cols, edges);
+	gridCols = cols;
+	heuristic = manhattan;
+	DStarLite dstar;
+	dstar.init(0, rows * cols - 1);
+	double t0 = now();
+	dstar.computeShortestPath();
+	printf("Initial plan: %ld expanded, %.3lf ms\n", dstar.expanded, 1e3 * (now() - t0));
+
+	// Change more and more edges
+	const int numTrials = 10;
+	printf("%8s %14s %14s %14s %14s %s\n", "#changes", "dstar expanded", "dstar ms",
+		"astar expanded", "astar ms", "mismatches");
+	for(int k = 1; k <= 10000; k *= 10) {
+		double dstarTime = 0.0, astarTime = 0.0;
+		long dstarExpanded = 0, astarExpanded = 0;
+		int mismatches = 0;
+		for(int trial = 0; trial < numTrials; trial++) {
+
+			// The robot takes a step along its plan, so that A* below starts from there too
+			vector <int> nodes;
+			dstar.path(nodes);
+			if(nodes.size() > 1) {
+				dstar.moveTo(nodes[1]);
+				nodes.erase(nodes.begin());
+			}
+
+			// Pick edges incident to random nodes on the rest of the path and give them new lengths
+			vector <Edge> changes;
+			for(int i = 0; i < k; i++) {
+				int u = nodes[rand() % nodes.size()];
+				int e = graph.offsets[u] + rand() % (graph.offsets[u+1] - graph.offsets[u]);
+				changes.push_back(Edge(u, graph.targets[e], 1.0 + 9.0 * rand() / RAND_MAX));
+			}
+
+			// Repair the D* Lite search
+			long expanded0 = dstar.expanded;
+			double t1 = now();
+			for(size_t i = 0; i < changes.size(); i++)
+				dstar.updateEdge(changes[i].from, changes[i].to, changes[i].weight);
+			dstar.replan();
+			dstarTime += now() - t1;
+			dstarExpanded += dstar.expanded - expanded0;
+
+			// Plan from scratch
+			double t2 = now();
+			double cost = astar(dstar.start, dstar.goal, astarExpanded);
+			astarTime += now() - t2;
+			if(fabs(cost - dstar.cost()) > 1e-6 * cost) mismatches++;
+		}
+		printf("%8d %14.1lf %14.3lf %14.1lf %14.3lf %d\n", k, ((double) dstarExpanded) / numTrials,
+			1e3 * dstarTime / numTrials, ((double) astarExpanded) / numTrials,
+			1e3 * astarTime / numTrials, mismatches);
+	}
+}
+
+/* ******************************************************************************************** */
+int main (int argc, char* argv[]) {
+
+	srand(time(NULL));
+	if((argc > 3) && (strcmp(argv[1], "-b") == 0)) {
+		benchmark(atoi(argv[2]), atoi(argv[3]));
+		return 0;
+	}
+
+	// Plan from Bucharest to Arad; the straight-line distances are to Bucharest, the start
+	bool loaded = loadText(graph, "../A*/data.txt");
+	assert(loaded && "Could not read the map");
+	DStarLite dstar;
+	dstar.init(graph.id("Bucharest"), graph.id("Arad"));
+	dstar.computeShortestPath();
+	printPath(dstar);
+
+	// The road between Pitesti and Rimnicu Vilcea closes; repair the plan
+	printf("\nPitesti - RimnicuVilcea closed.\n");
+	dstar.updateEdge(graph.id("Pitesti"), graph.id("RimnicuVilcea"), 1e4);
+	dstar.replan();
+	printPath(dstar);
+
+	// The robot drives to Fagaras and finds the road to Sibiu closed too; repair the plan from
+	// there and check it against A* from scratch
+	printf("\nAt Fagaras, Fagaras - Sibiu closed.\n");
+	dstar.moveTo(graph.id("Fagaras"));
+	dstar.updateEdge(graph.id("Fagaras"), graph.id("Sibiu"), 1e4);
+	dstar.replan();
+	printPath(dstar);
+	long expanded = 0;
+	printf("A* from scratch: %lf\n", astar(dstar.start, dstar.goal, expanded));
+}
+/* ******************************************************************************************** */
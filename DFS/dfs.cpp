@@ -2,206 +2,408 @@
  * @file dfs.cpp
  * @author Can Erdogan
  * @date July 12, 2015
- * @brief Implementation of depth-first search for the 8-puzzle example in Russell & Norvig AI 
+ * @brief Implementation of depth-first search for the 8-puzzle example in Russell & Norvig AI
  * book. Start state: 7 2 4; 5 N 6; 8 3 1. Goal state: N 1 2; 3 4 5; 6 7 8.
  * NOTE: Finding the path. With recursive implementation, because we visit earlier states, 
  * the path information is preserved in the stack memory. In iterative, we need to allocate
  * additional memory for this information.
+ * A board is packed into a 64-bit word with 4 bits per cell (cell i, in row-major order, in
+ * bits 4i..4i+3) and 0 for the empty cell, so boards up to 4x4 (the 15-puzzle) fit and a move is
+ * a few shifts. Other boards can be given as tiles in row-major order: ./a.out [-d] [-r <rows>]
+ * <tiles>, e.g. ./a.out 4 1 2 3 5 0 6 7 8 9 10 11 12 13 14 15.
+ * With -i <pdb file> first, the board is solved optimally with IDA* instead, guided by additive
+ * pattern databases that are read from the file (memory-mapped) and built into it the first
+ * time, e.g. ./a.out -i 15.pdb 14 13 15 7 11 12 9 5 6 0 2 1 4 8 10 3 (Korf's first instance).
  */
 
 #include <assert.h>
+#include <deque>
+#include <fcntl.h>
+#include <limits.h>
 #include <iostream>
 #include <math.h>
 #include <stack>
-#include <set>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
 #include <vector>
+#include "../BFS/puzzle.h"
 
 using namespace std;
 
 bool debugVis = false;			///< Visualize the search with graphviz
-#define digit(number,n) ((number/((int) pow(10, n)))%10)	 ///< Returns the nth digit of a #
 
 /* ******************************************************************************************** */
-struct State {
-	int depth;		
-	int actionBefore;
-	int val;
-	State* prev;
-	State (int d, int a, int v, State* p) : depth(d), actionBefore(a), val(v), prev(p) {}
-};
-stack <State*> states; 	/// A state is a 9 digit number with 0 representing the empty cell
+stack <uint32_t> states; 	/// A state is a packed board with 0 representing the empty cell
 vector <int> actions;
-int offsets [4] = {-3, -1, 3, 1};
-
-/* ******************************************************************************************** */
-inline int applyAction (int val, int index, int actionIdx) {
-
-	static const bool dbg = 0;
-	int offset = offsets[actionIdx];
-	int new_index = index + offset;
-	if(dbg) printf("%d vs. %d, %d, idx: %d\n", index, new_index, offset, actionIdx);
-	assert((actionIdx >= 0) && (actionIdx <= 3));
-	if((new_index < 0) | (new_index > 8)) {
-		if(dbg) printf("\treason 1\n");
-		return -1;
-	}
-	if(((offset == 1) || (offset == -1)) && ((index / 3) != (new_index / 3))) {
-		if(dbg) printf("\treason 2\n");
-		return -1;
-	}
-
-	// Get the digit that is being moved to the empty cell
-	int tenthPowerNew = ((int) pow(10, new_index));
-	int digitNew = (val / tenthPowerNew) % 10;
-
-	// Create the new val by removing the new digit value 
-	int tenthPowerOld = ((int) pow(10, index));
-	int new_val = val - digitNew * (tenthPowerNew - tenthPowerOld);
-	return new_val;
-}
-
-/* ******************************************************************************************** */
-/// Generates new states in the search tree from the input and pushes them onto the stack
-void generateStates (State& state) {
-
-	// Find the location of the empty cell
-	int index = -1;
-	int val = state.val;
-	int val_ = val;
-	for(size_t i = 0; i < 9; i++) {
-		if(val_ % 10 == 0) {
-			index = i;
-			break;
-		}
-		val_ /= 10;
-	}
-	
-	// Generate the new val based on the location
-	for(size_t n = 0; n < 4; n++) {
-
-		// Get the possible neighbor and see if it exists
-		int new_index = index + offsets[n];
-		// printf("%d vs. %d\n", index, new_index);
-		if((new_index < 0) | (new_index > 8)) continue;
-		if(((offsets[n] == 1) || (offsets[n] == -1)) && ((index / 3) != (new_index / 3))) continue;
-
-		// Get the digit that is being moved to the empty cell
-		int tenthPowerNew = ((int) pow(10, new_index));
-		int digitNew = (val / tenthPowerNew) % 10;
-	
-		// Create the new val by removing the new digit value 
-		int tenthPowerOld = ((int) pow(10, index));
-		int new_val = val - digitNew * (tenthPowerNew - tenthPowerOld);
-		
-		// Push to the stack
-		// printf("\t%09d\n", new_val);
-		states.push(new State(state.depth + 1, n, new_val, &state));
-	}
-}
 
 /* ******************************************************************************************** */
 void printStack() {
 	while(!states.empty()) {
-		int s = states.top()->val;
+		Board s = arena[states.top()].val;
 		states.pop();
-		printf("%09d\n", s);
+		printf("%016llx\n", (unsigned long long) s);
 	}
 }
 
 /* ******************************************************************************************** */
-void printState (int s) {
-	int a = (s / ((int) 1e6));
-	int b = ((s / ((int) 1e3))) % 1000;
-	int c = s % 1000;
-	printf("%03d\n%03d\n%03d\n", a, b, c);
+double now () {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1e-6 * tv.tv_usec;
 }
 
 /* ******************************************************************************************** */
 /// Implements DFS and outputs the path of actions that reaches the goal state if one exists
 /// Returns true if the goal is reached; false, otherwise.
-bool dfs (State& s0) {
+bool dfs (uint32_t s0) {
 
 	// Keep track of seen states to avoid loops
-	set <int> seen;
-	seen.insert(s0.val);
-	
+	Visited seen;
+	seen.init();
+	seen.insert(arena[s0].val);
+
 	// Populate stack using initial state
-	generateStates(s0);
+	generateStates(s0, states);
 	static const bool dbg = 0;
 
 	// Keep searching until there is children states
 	while(!states.empty()) {
 
 		// Get the child state
-		State* state = states.top();	
-		int val = state->val;
+		uint32_t idx = states.top();
+		const State& state = arena[idx];
+		Board val = state.val;
 		states.pop();
-		
+
 		// Debug information
 		if(dbg) {
-			printf("=== level: %d ======> \n", state->depth);
+			printf("=== level: %d ======> \n", (int) state.depth);
 			printState(val);
 			// getchar();
 		}
 
 		// Check if the child is seen
-		if(seen.find(val) != seen.end()) {
+		if(!seen.insert(val)) {
 			if(dbg) printf(">>>>> seen before.\n");
 			continue;
 		}
-		seen.insert(val);
 
 		// Check if the child is the goal
-		if(val == 12345678) {
-			State* s = state;
-			while(s != NULL) {
-				if(s->actionBefore != -1) actions.push_back(s->actionBefore);
-				s = s->prev;
-			}
-			printf("# of actions: %d\n", actions.size());
+		if(val == goal) {
+			for(uint32_t s = idx; arena[s].prev != NONE; s = arena[s].prev)
+				actions.push_back(arena[s].actionBefore);
+			printf("# of actions: %lu\n", actions.size());
 			return true;
 		}
 
 		// Generate grandchildren
-		generateStates(*state);
+		generateStates(idx, states);
 		if(dbg) printf(">>>>> not yet.\n");
-	} 
-	
+	}
+
 	assert(false && "NO SOLUTION\n");
 	return false;
 }
 
 /* ******************************************************************************************** */
-void applyActions (int s) {
+/// Returns n!/(n-k)!, the number of ways to place k distinct items on n cells
+inline uint32_t arrangements (int n, int k) {
+	uint32_t r = 1;
+	for(int i = 0; i < k; i++) r *= n - i;
+	return r;
+}
+
+/// Returns a dense index of the cells of k distinct items among the arrangements(numCells, k):
+/// the ith digit is the number of cells below cells[i] not taken by the items before it.
+inline uint32_t partialRank (const int* cells, int k) {
+	uint32_t r = 0;
+	unsigned used = 0;
+	for(int i = 0; i < k; i++) {
+		r = r * (numCells - i) + (cells[i] - __builtin_popcount(used & ((1u << cells[i]) - 1)));
+		used |= (1u << cells[i]);
+	}
+	return r;
+}
+
+/// The inverse of partialRank
+inline void partialUnrank (uint32_t r, int* cells, int k) {
+	int digits [16];
+	for(int i = k - 1; i >= 0; i--) digits[i] = r % (numCells - i), r /= (numCells - i);
+	unsigned used = 0;
+	for(int i = 0; i < k; i++) {
+		int c = 0;
+		for(int d = digits[i]; (used & (1u << c)) || (d-- > 0); c++);
+		cells[i] = c;
+		used |= (1u << c);
+	}
+}
+
+/* ******************************************************************************************** */
+/// Builds the table of a group of tiles: the fewest moves of these tiles that bring them to their
+/// goal cells from each placement, where the other tiles look alike and move for free. Since only
+/// the moves of its own tiles are counted, the tables of disjoint groups can be added up. A 0-1
+/// BFS from the goal runs over the placements of the group and the empty cell (which decides the
+/// free moves), and the table keeps the minimum over the cells of the empty one.
+void buildTable (const vector <int>& group, vector <uint8_t>& table) {
+
+	int k = group.size(), cells [17];
+	vector <uint8_t> dist (arrangements(numCells, k + 1), 255);
+	table.assign(arrangements(numCells, k), 255);
+	deque <uint32_t> queue;
+	cells[0] = 0;
+	for(int i = 0; i < k; i++) cells[i + 1] = group[i];
+	uint32_t r0 = partialRank(cells, k + 1);
+	dist[r0] = 0;
+	queue.push_back(r0);
+	while(!queue.empty()) {
+		uint32_t r = queue.front();
+		queue.pop_front();
+		partialUnrank(r, cells, k + 1);
+		int d = dist[r], blank = cells[0];
+		uint8_t& entry = table[partialRank(cells + 1, k)];
+		entry = min((int) entry, d);
+
+		// Move the empty cell; it costs a move only if it swaps with a tile of the group
+		for(int a = 0; a < 4; a++) {
+			int next = moves[blank][a];
+			if(next == -1) continue;
+			int j = 1;
+			while((j <= k) && (cells[j] != next)) j++;
+			int w = (j <= k);
+			cells[0] = next;
+			if(w) cells[j] = blank;
+			uint32_t s = partialRank(cells, k + 1);
+			if(d + w < dist[s]) {
+				dist[s] = d + w;
+				if(w) queue.push_back(s);
+				else queue.push_front(s);
+			}
+			cells[0] = blank;
+			if(w) cells[j] = next;
+		}
+	}
+}
+
+/* ******************************************************************************************** */
+/// Additive pattern databases: the tiles are split into disjoint groups (6-6-3 for the 15-puzzle
+/// and 4-4 for the 8-puzzle), each with a byte per placement of its tiles. The file holds the
+/// int32 rows, cols and #groups, then the size and tiles of each group, then the tables, and is
+/// memory-mapped so that it is loaded lazily and shared between runs.
+struct PatternDatabase {
+
+	vector <vector <int> > groups;
+	vector <const uint8_t*> tables;
+	int groupOf [16];										///< Group of each tile
+	int cellOf [16];										///< Current cell of each tile during the search
+	int values [16];										///< Current table value of each group
+	void* map;
+	size_t mapSize;
+
+	PatternDatabase () : map(NULL), mapSize(0) {}
+	~PatternDatabase () { unmap(); }
+
+	void unmap () {
+		if(map != NULL) munmap(map, mapSize);
+		map = NULL, mapSize = 0;
+		groups.clear(), tables.clear();
+	}
+
+	/// Splits the tiles into groups of at most 6 consecutive ones, or the blocks of Korf and
+	/// Felner's 6-6-3 partitioning for the 15-puzzle
+	void partition () {
+		groups.clear();
+		if(numCells == 16) {
+			int blocks [3][6] = {{1, 2, 3}, {4, 5, 8, 9, 12, 13}, {6, 7, 10, 11, 14, 15}};
+			for(int g = 0; g < 3; g++) groups.push_back(vector <int> (blocks[g], blocks[g] + (g ? 6 : 3)));
+			return;
+		}
+		int numGroups = (numCells + 4) / 6, tile = 1;
+		for(int g = 0; g < numGroups; g++) {
+			groups.push_back(vector <int> ());
+			int size = (numCells - 1) / numGroups + (g < (numCells - 1) % numGroups);
+			for(int i = 0; i < size; i++) groups[g].push_back(tile++);
+		}
+	}
+
+	/// Builds the tables for the current board size and writes them to the file
+	bool save (const char* fileName) {
+		partition();
+		FILE* file = fopen(fileName, "wb");
+		if(file == NULL) return false;
+		int32_t header [3] = {rows, cols, (int32_t) groups.size()};
+		fwrite(header, sizeof(int32_t), 3, file);
+		for(size_t g = 0; g < groups.size(); g++) {
+			int32_t size = groups[g].size();
+			fwrite(&size, sizeof(int32_t), 1, file);
+			for(int i = 0; i < size; i++) {
+				int32_t t = groups[g][i];
+				fwrite(&t, sizeof(int32_t), 1, file);
+			}
+		}
+		for(size_t g = 0; g < groups.size(); g++) {
+			vector <uint8_t> table;
+			double t0 = now();
+			buildTable(groups[g], table);
+			printf("Built the table of %lu tiles: %lu entries, %.3lf s\n", groups[g].size(),
+				table.size(), now() - t0);
+			fwrite(&table[0], 1, table.size(), file);
+		}
+		return (fclose(file) == 0);
+	}
+
+	/// Maps the file into memory, replacing the tables loaded before. Returns false, with no
+	/// tables, if it cannot be read or is not a database of this board size: the header, the
+	/// groups (of at most 8 tiles, so that the table indices fit 32 bits) and the table sizes
+	/// must all fit the file exactly.
+	bool load (const char* fileName) {
+		unmap();
+		int fd = open(fileName, O_RDONLY);
+		if(fd == -1) return false;
+		struct stat st;
+		if(fstat(fd, &st) == -1 || st.st_size < (off_t) (3 * sizeof(int32_t))) {
+			close(fd);
+			return false;
+		}
+		mapSize = st.st_size;
+		map = mmap(NULL, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if(map == MAP_FAILED) {
+			map = NULL, mapSize = 0;
+			return false;
+		}
+
+		// Read the groups, checking each word against the end of the file
+		const int32_t* header = (const int32_t*) map, *end = header + mapSize / sizeof(int32_t);
+		bool valid = (header[0] == rows) && (header[1] == cols) && (header[2] > 0) &&
+			(header[2] < numCells);
+		const int32_t* p = header + 3;
+		for(int g = 0; valid && g < header[2]; g++) {
+			valid = (p < end) && (*p > 0) && (*p <= 8) && (*p < numCells) && (*p <= end - p - 1);
+			for(int i = 1; valid && i <= *p; i++) valid = (p[i] > 0) && (p[i] < numCells);
+			if(valid) groups.push_back(vector <int> (p + 1, p + 1 + *p)), p += *p + 1;
+		}
+
+		// The tables must take the rest of the file
+		const uint8_t* table = (const uint8_t*) p, *fileEnd = (const uint8_t*) map + mapSize;
+		for(size_t g = 0; valid && g < groups.size(); g++) {
+			size_t size = arrangements(numCells, groups[g].size());
+			valid = (size <= (size_t) (fileEnd - table));
+			tables.push_back(table);
+			table += size;
+			for(size_t i = 0; i < groups[g].size(); i++) groupOf[groups[g][i]] = g;
+		}
+		if(valid && (table == fileEnd)) return true;
+		unmap();
+		return false;
+	}
+
+	/// Returns the table value of the group for the tile cells in cellOf
+	inline int lookup (int g) const {
+		int cells [16], k = groups[g].size();
+		for(int i = 0; i < k; i++) cells[i] = cellOf[groups[g][i]];
+		return tables[g][partialRank(cells, k)];
+	}
+
+	/// Sets the tile cells from the board and returns the heuristic value
+	int reset (Board val) {
+		for(int i = 0; i < numCells; i++) cellOf[tile(val, i)] = i;
+		int h = 0;
+		for(size_t g = 0; g < groups.size(); g++) h += (values[g] = lookup(g));
+		return h;
+	}
+};
+
+PatternDatabase pdb;
+long idaExpanded = 0;
+
+/* ******************************************************************************************** */
+/// Returns true if the goal can be reached. On odd widths a move keeps the parity of the order of
+/// the tiles; on even widths a vertical move flips it along with the row of the empty cell.
+bool solvable (Board val) {
+	int inversions = 0;
+	for(int i = 0; i < numCells; i++) {
+		for(int j = i + 1; j < numCells; j++) {
+			int a = tile(val, i), b = tile(val, j);
+			if(a && b && (a > b)) inversions++;
+		}
+	}
+	if(cols % 2 == 0) inversions += blankCell(val) / cols;
+	return (inversions % 2 == 0);
+}
+
+/* ******************************************************************************************** */
+/// Searches below the board within the cost bound. Returns -1 if the goal is found (with the
+/// actions pushed from the last one back), or else the smallest f value over the bound. Only the
+/// group of the moved tile needs a new table lookup, and undoing the last move is skipped.
+int idaSearch (Board val, int blank, int g, int h, int bound, int prevBlank) {
+
+	int f = g + h;
+	if(f > bound) return f;
+	if(val == goal) return -1;
+	idaExpanded++;
+
+	int next = INT_MAX;
+	for(int a = 0; a < 4; a++) {
+		int cell = moves[blank][a];
+		if((cell == -1) || (cell == prevBlank)) continue;
+
+		// Move the tile and update the value of its group
+		int t = tile(val, cell), gi = pdb.groupOf[t], old = pdb.values[gi];
+		pdb.cellOf[t] = blank;
+		pdb.values[gi] = pdb.lookup(gi);
+		int result = idaSearch(applyAction(val, blank, a), cell, g + 1, h - old + pdb.values[gi], bound,
+			blank);
+		pdb.cellOf[t] = cell;
+		pdb.values[gi] = old;
+
+		if(result == -1) {
+			actions.push_back(a);
+			return -1;
+		}
+		next = min(next, result);
+	}
+	return next;
+}
+
+/* ******************************************************************************************** */
+/// Iterative-deepening A*: depth-first searches with an increasing bound on the cost plus the
+/// pattern database estimate. Memory is the recursion only, and the path found is optimal.
+bool ida (Board s0) {
+	if(!solvable(s0)) {
+		printf("No solution.\n");
+		return false;
+	}
+	int h0 = pdb.reset(s0);
+	for(int bound = h0; ; ) {
+		printf("Bound %d: %ld expanded so far\n", bound, idaExpanded);
+		int result = idaSearch(s0, blankCell(s0), 0, h0, bound, -1);
+		if(result == -1) break;
+		bound = result;
+	}
+	printf("# of actions: %lu\n", actions.size());
+	return true;
+}
+
+/* ******************************************************************************************** */
+void applyActions (Board s) {
 
 	printf("\nInitial state:\n");
 	printState(s);
 
-	int val = s;
-	int step = actions.size() / 10;
+	Board val = s;
 	for(int act_idx = actions.size()-1; act_idx >= 0; act_idx--) {
 
-		
-		// Find where the empty cell is
-		int index = -1;
-		int val_ = val;
-		for(size_t i = 0; i < 9; i++) {
-			if(val_ % 10 == 0) {
-				index = i;
-				break;
-			}
-			val_ /= 10;
-		}
-	
-		// Apply the action
-		int val2 = applyAction(val, index, actions[act_idx]);
-		val = val2;
-		assert(val != -1);
+		// Apply the action at the empty cell
+		val = applyAction(val, blankCell(val), actions[act_idx]);
+		assert(val != 0);
 		if(act_idx < 10) {
-			printf("\nState %d:\n", actions.size() - act_idx);
+			printf("\nState %lu:\n", actions.size() - act_idx);
 			printState(val);
 		}
 	}
@@ -214,12 +416,56 @@ void applyActions (int s) {
 int main (int argc, char* argv[]) {
 
 	// Parse the input
-	if((argc > 1) && (strcmp(argv[1], "-d") == 0)) debugVis = true;
+	int arg = 1;
+	bool rowsGiven = false;
+	const char* pdbFile = NULL;
+	if((argc > arg + 1) && (strcmp(argv[arg], "-i") == 0)) pdbFile = argv[arg + 1], arg += 2;
+	if((argc > arg) && (strcmp(argv[arg], "-d") == 0)) debugVis = true, arg++;
+	if((argc > arg + 1) && (strcmp(argv[arg], "-r") == 0)) {
+		rows = atoi(argv[arg + 1]), arg += 2;
+		rowsGiven = true;
+	}
+
+	// Read the board or use the book example
+	Board s0 = 0;
+	int tiles [] = {7, 2, 4, 5, 0, 6, 8, 3, 1};
+	numCells = (argc > arg) ? (argc - arg) : 9;
+	if(!rowsGiven) rows = (int) (sqrt(numCells) + 0.5);
+	cols = numCells / rows;
+	assert((rows * cols == numCells) && (numCells <= 16) && "Bad board size");
+	for(int i = 0; i < numCells; i++) {
+		Board t = (argc > arg) ? atoi(argv[arg + i]) : tiles[i];
+		assert(t < (Board) numCells);
+		s0 |= t << (4 * i);
+	}
+	initMoves();
+
+	// Solve optimally with IDA*, building the pattern databases the first time
+	if(pdbFile != NULL) {
+		if(!pdb.load(pdbFile)) {
+			if(access(pdbFile, F_OK) == 0) {
+				printf("%s is not a pattern database for a %dx%d board\n", pdbFile, rows, cols);
+				return 1;
+			}
+			printf("Building the pattern databases in %s...\n", pdbFile);
+			bool saved = pdb.save(pdbFile);
+			assert(saved && "Could not write the pattern databases");
+			bool loaded = pdb.load(pdbFile);
+			assert(loaded && "Could not read the pattern databases");
+		}
+		double t0 = now();
+		if(!ida(s0)) return 0;
+		printf("IDA*: %ld expanded, %.3lf s, %.0lf nodes/s\n", idaExpanded, now() - t0,
+			idaExpanded / (now() - t0));
+		applyActions(s0);
+		return 0;
+	}
 
 	// Perform DFS
-	int s0 = 724506831;
-	State state0 (0,-1,s0,NULL);
-	dfs(state0);
+	double t0 = now();
+	dfs(arena.alloc(s0, NONE, 0, 0));
+	printStats(now() - t0);
+	arena.release();
 
 	// Apply actions to the initial state
 	applyActions(s0);
@@ -3,18 +3,32 @@
  * @author Can Erdogan
  * @date 2015-08-08.cpp
  * @brief Implementation of dynamic programming to solve the "Longest Common Subsequence" problem.
+ * Usage: ./a.out <S> <T>                 (memoized recursion, for short strings)
+ *        ./a.out -f <file S> <file T>    (row by row in linear space, for long inputs)
+ *        ./a.out -b <#strings> <length>  (bit-parallel lengths against the table, per instruction set)
+ *        ./a.out -w <length> <#threads>  (tiled wavefront on random strings, with 1..#threads threads)
+ *        ./a.out -p <file> <#threads> [threshold]  (similarity of all pairs of lines: the matrix, or
+ *                                                   the pairs at or above the threshold)
+ * Compile with -std=c++11 -pthread.
  */
 
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
 #include <iostream>
 #include <fstream>
+#include <immintrin.h>
 #include <math.h>
+#include <mutex>
 #include <queue>
 #include <map>
 #include <set>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <thread>
 #include <vector>
 
 using namespace std;
@@ -26,7 +40,7 @@ int N, M;
 void recover (const char* S, int n, int m, string& s) {
 	static const bool dbg = 0;
 	if(dbg) printf("Call: (%d, %d)\n", n, m);
-	if(n < 0 || m < 0) return;
+	if(n < 0 || m < 0 || memory[n * M + m] == 0) return;
 	else if(n > 0 && (memory[n * M + m] == memory[(n-1) * M + m])) recover(S, n-1, m, s); 
 	else if(m > 0 && (memory[n * M + m] == memory[n * M + m - 1])) recover(S, n, m-1, s); 
 	else {
@@ -62,8 +76,456 @@ int lcs (const char* S, int n, const char* T, int m) {
 	return res;
 }
 
+/* ******************************************************************************************** */
+/// Fills row[j] with the LCS length of S[0..n) and T[0..j) for every j <= m, keeping one row of
+/// the table. Reversed, both strings are read from the end: row[j] is then the length for S[0..n)
+/// and T[m-j..m).
+template <bool reversed>
+void lcsRow (const char* S, int n, const char* T, int m, int* row) {
+	for(int j = 0; j <= m; j++) row[j] = 0;
+	for(int i = 0; i < n; i++) {
+		char c = reversed ? S[n - 1 - i] : S[i];
+		int diagonal = 0;
+		for(int j = 1; j <= m; j++) {
+			int up = row[j];
+			char t = reversed ? T[m - j] : T[j - 1];
+			row[j] = (c == t) ? (diagonal + 1) : max(up, row[j - 1]);
+			diagonal = up;
+		}
+	}
+}
+
+/* ******************************************************************************************** */
+/// Returns the LCS length with the table kept a row at a time over the shorter string
+int lcsLength (const char* S, int n, const char* T, int m) {
+	if(m > n) swap(S, T), swap(n, m);
+	vector <int> row (m + 1);
+	lcsRow <false> (S, n, T, m, &row[0]);
+	return row[m];
+}
+
+/* ******************************************************************************************** */
+/// Appends an LCS of S and T to s with Hirschberg's divide and conquer: the forward row for the
+/// first half of S and the backward row for the second half give the cut of T where an LCS
+/// crosses the middle of S, and the two halves are solved independently. The rows are reused
+/// (their size is that of the first T), so the memory is linear and the time about twice the DP.
+void hirschberg (const char* S, int n, const char* T, int m, string& s, vector <int>& forward,
+		vector <int>& backward) {
+
+	if(n == 0 || m == 0) return;
+	if(n == 1) {
+		if(memchr(T, S[0], m) != NULL) s += S[0];
+		return;
+	}
+
+	// Find the cut of T
+	int mid = n / 2, best = -1, cut = 0;
+	lcsRow <false> (S, mid, T, m, &forward[0]);
+	lcsRow <true> (S + mid, n - mid, T, m, &backward[0]);
+	for(int j = 0; j <= m; j++) {
+		if(forward[j] + backward[m - j] > best) best = forward[j] + backward[m - j], cut = j;
+	}
+
+	hirschberg(S, mid, T, cut, s, forward, backward);
+	hirschberg(S + mid, n - mid, T + cut, m - cut, s, forward, backward);
+}
+
+/// Returns an LCS in O(min(n, m)) memory
+string hirschberg (const char* S, int n, const char* T, int m) {
+	if(m > n) swap(S, T), swap(n, m);
+	vector <int> forward (m + 1), backward (m + 1);
+	string s;
+	hirschberg(S, n, T, m, s, forward, backward);
+	return s;
+}
+
+/* ******************************************************************************************** */
+/// Bit-parallel LCS length (Allison and Dix, in Hyyro's form). Bit i of V stands for row i of a
+/// column of the table over S, and a character c of T advances the whole column with
+///   U = V & Peq[c],  V = (V + U) | (V & ~Peq[c])
+/// where Peq[c] marks the positions of c in S; the LCS is the number of zero bits of V. Long
+/// strings take several 64-bit words with the carry of the addition passed up.
+/// The kernels run one T against several S at once, one per 64-bit lane: the Peq words of a
+/// character for all the lanes are adjacent and load as one vector. The rows past the end of a
+/// shorter S have zero Peq bits, and as the carries only go up they never change its count.
+enum Isa { SCALAR, AVX2, AVX512 };
+const char* isaNames [] = {"scalar", "avx2", "avx512"};
+const int isaLanes [] = {1, 4, 8};
+
+/// Returns the widest instruction set of the processor
+Isa detectIsa () {
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f")) return AVX512;
+	if(__builtin_cpu_supports("avx2")) return AVX2;
+	return SCALAR;
+}
+
+/* ******************************************************************************************** */
+/// The kernels update v (word-major, then lane) for each character of T
+void kernelScalar (const uint64_t* peq, uint64_t* v, int words, const char* T, int m) {
+	for(int j = 0; j < m; j++) {
+		const uint64_t* p = peq + ((unsigned char) T[j]) * words;
+		uint64_t carry = 0;
+		for(int w = 0; w < words; w++) {
+			uint64_t x = v[w], s = x + (x & p[w]), s2 = s + carry;
+			carry = (s < x) | (s2 < s);
+			v[w] = s2 | (x & ~p[w]);
+		}
+	}
+}
+
+/// Four lanes; the carries are all-ones masks, and unsigned comparisons flip the sign bits
+__attribute__ ((target ("avx2")))
+void kernelAVX2 (const uint64_t* peq, uint64_t* v, int words, const char* T, int m) {
+	const __m256i sign = _mm256_set1_epi64x(0x8000000000000000LL), zero = _mm256_setzero_si256();
+	for(int j = 0; j < m; j++) {
+		const uint64_t* p = peq + ((unsigned char) T[j]) * words * 4;
+		__m256i carry = zero;
+		for(int w = 0; w < words; w++) {
+			__m256i x = _mm256_loadu_si256((const __m256i*) (v + 4 * w));
+			__m256i eq = _mm256_loadu_si256((const __m256i*) (p + 4 * w));
+			__m256i s = _mm256_add_epi64(x, _mm256_and_si256(x, eq));
+			__m256i s2 = _mm256_sub_epi64(s, carry);
+			__m256i c1 = _mm256_cmpgt_epi64(_mm256_xor_si256(x, sign), _mm256_xor_si256(s, sign));
+			carry = _mm256_or_si256(c1, _mm256_and_si256(carry, _mm256_cmpeq_epi64(s2, zero)));
+			_mm256_storeu_si256((__m256i*) (v + 4 * w), _mm256_or_si256(s2, _mm256_andnot_si256(eq, x)));
+		}
+	}
+}
+
+/// Eight lanes; the carries are mask registers
+__attribute__ ((target ("avx512f")))
+void kernelAVX512 (const uint64_t* peq, uint64_t* v, int words, const char* T, int m) {
+	const __m512i one = _mm512_set1_epi64(1), zero = _mm512_setzero_si512();
+	for(int j = 0; j < m; j++) {
+		const uint64_t* p = peq + ((unsigned char) T[j]) * words * 8;
+		__mmask8 carry = 0;
+		for(int w = 0; w < words; w++) {
+			__m512i x = _mm512_loadu_si512(v + 8 * w), eq = _mm512_loadu_si512(p + 8 * w);
+			__m512i s = _mm512_add_epi64(x, _mm512_and_si512(x, eq));
+			__m512i s2 = _mm512_mask_add_epi64(s, carry, s, one);
+			carry = _mm512_cmplt_epu64_mask(s, x) | (carry & _mm512_cmpeq_epi64_mask(s2, zero));
+			_mm512_storeu_si512(v + 8 * w, _mm512_ternarylogic_epi64(s2, eq, x, 0xF2));	// s2 | (x & ~eq)
+		}
+	}
+}
+
+/* ******************************************************************************************** */
+/// The buffers of the bit-parallel kernels, reused across calls. Peq is all zeros between calls.
+struct BitLCS {
+
+	vector <uint64_t> peq;							///< (character, word, lane)
+	vector <uint64_t> v;								///< (word, lane)
+
+	/// Returns the zeros of V in the first len rows of a lane
+	int zeros (int lane, int len, int lanes) const {
+		int res = 0;
+		for(int w = 0; w * 64 < len; w++) {
+			uint64_t z = ~v[w * lanes + lane];
+			if(len - w * 64 < 64) z &= (1ULL << (len - w * 64)) - 1;
+			res += __builtin_popcountll(z);
+		}
+		return res;
+	}
+
+	/// Computes the LCS length of T and each S[i] into out[i] with the given instruction set. If
+	/// need is given, T is run in chunks and a batch stops once none of its strings can reach
+	/// need[i] even by matching all of the rest of T; out[i] is -1 for the strings below need[i].
+	void run (const char* T, int m, const char* const* S, const int* n, int count, int* out, Isa isa,
+			const int* need = NULL) {
+		static const int chunk = 512;
+		int lanes = isaLanes[isa];
+		for(int first = 0; first < count; first += lanes) {
+
+			// Set the Peq bits of the strings of the batch
+			int batch = min(lanes, count - first), words = 1;
+			for(int l = 0; l < batch; l++) words = max(words, (n[first + l] + 63) / 64);
+			if(peq.size() < (size_t) 256 * words * lanes) peq.resize(256 * words * lanes, 0);
+			for(int l = 0; l < batch; l++) {
+				for(int i = 0; i < n[first + l]; i++)
+					peq[(((unsigned char) S[first + l][i]) * words + i / 64) * lanes + l] |= 1ULL << (i % 64);
+			}
+			v.assign(words * lanes, ~0ULL);
+
+			for(int j = 0; j < m; j += chunk) {
+				int len = (need == NULL) ? m : min(chunk, m - j);
+				if(isa == AVX512) kernelAVX512(&peq[0], &v[0], words, T + j, len);
+				else if(isa == AVX2) kernelAVX2(&peq[0], &v[0], words, T + j, len);
+				else kernelScalar(&peq[0], &v[0], words, T + j, len);
+				if(need == NULL || j + len >= m) break;
+				bool reachable = false;
+				for(int l = 0; l < batch && !reachable; l++)
+					reachable = (zeros(l, n[first + l], lanes) + m - j - len >= need[first + l]);
+				if(!reachable) break;
+			}
+
+			// Count the zeros in the rows of each S and clear its Peq bits
+			for(int l = 0; l < batch; l++) {
+				int len = n[first + l];
+				out[first + l] = zeros(l, len, lanes);
+				if(need != NULL && out[first + l] < need[first + l]) out[first + l] = -1;
+				for(int i = 0; i < len; i++)
+					peq[(((unsigned char) S[first + l][i]) * words + i / 64) * lanes + l] = 0;
+			}
+		}
+	}
+};
+
+/// Returns the LCS length with the bit-parallel kernel
+int lcsBits (const char* S, int n, const char* T, int m) {
+	BitLCS bits;
+	int res;
+	bits.run(T, m, &S, &n, 1, &res, SCALAR);
+	return res;
+}
+
+/* ******************************************************************************************** */
+/// Parallel LCS length for very long strings: the bit-parallel columns are cut into tiles of
+/// tileWords words of V (rows of S) by tileCols characters of T. As with the cells of lcs(), a
+/// tile only depends on the one to its left (through its words of V) and the one above (through
+/// the carry out of its last word, one per character of T), so the tiles on an anti-diagonal can
+/// run at once. Thread t computes the tile rows t, t + #threads, ... left to right and waits for
+/// the row above to be ahead of it, which keeps the threads on a moving wavefront.
+int lcsWavefront (const char* S, int n, const char* T, int m, int numThreads, int tileWords = 64,
+		int tileCols = 4096) {
+
+	// The match masks of S, the column V and the carries between the tile rows
+	int words = max(1, (n + 63) / 64);
+	vector <uint64_t> peq (256 * words, 0), v (words, ~0ULL);
+	for(int i = 0; i < n; i++) peq[((unsigned char) S[i]) * words + i / 64] |= 1ULL << (i % 64);
+	vector <uint8_t> carries (m, 0);
+
+	// The number of tiles done in each row
+	int tileRows = (words + tileWords - 1) / tileWords, numTiles = (m + tileCols - 1) / tileCols;
+	vector <atomic <int> > done (tileRows);
+	for(int r = 0; r < tileRows; r++) done[r] = 0;
+
+	vector <thread> threads;
+	for(int t = 0; t < numThreads; t++) {
+		threads.push_back(thread([&, t] () {
+			for(int r = t; r < tileRows; r += numThreads) {
+				int w0 = r * tileWords, w1 = min(words, w0 + tileWords);
+				for(int c = 0; c < numTiles; c++) {
+					while(r > 0 && done[r-1].load(memory_order_acquire) <= c) this_thread::yield();
+					int j1 = min(m, (c + 1) * tileCols);
+					for(int j = c * tileCols; j < j1; j++) {
+						const uint64_t* p = &peq[((unsigned char) T[j]) * words];
+						uint64_t carry = carries[j];
+						for(int w = w0; w < w1; w++) {
+							uint64_t x = v[w], s = x + (x & p[w]), s2 = s + carry;
+							carry = (s < x) | (s2 < s);
+							v[w] = s2 | (x & ~p[w]);
+						}
+						carries[j] = carry;
+					}
+					done[r].store(c + 1, memory_order_release);
+				}
+			}
+		}));
+	}
+	for(int t = 0; t < numThreads; t++) threads[t].join();
+
+	// Count the zeros in the rows of S
+	int res = 0;
+	for(int w = 0; w * 64 < n; w++) {
+		uint64_t zeros = ~v[w];
+		if(n - w * 64 < 64) zeros &= (1ULL << (n - w * 64)) - 1;
+		res += __builtin_popcountll(zeros);
+	}
+	return res;
+}
+
+/* ******************************************************************************************** */
+double now () {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
+
+/* ******************************************************************************************** */
+/// Computes the LCS lengths of the first random string with all the others, with the table and
+/// the bit-parallel kernels of each instruction set the processor has, and prints the cell rates
+void benchmark (int numStrings, int length) {
+
+	// Random strings over ACGT with lengths from length/2 to length
+	vector <string> strings (numStrings);
+	for(int i = 0; i < numStrings; i++) {
+		int n = length / 2 + rand() % (length / 2 + 1);
+		for(int j = 0; j < n; j++) strings[i] += "ACGT"[rand() % 4];
+	}
+	vector <const char*> S;
+	vector <int> n;
+	double cells = 0.0;
+	for(int i = 1; i < numStrings; i++) {
+		S.push_back(strings[i].c_str()), n.push_back(strings[i].size());
+		cells += ((double) strings[0].size()) * strings[i].size();
+	}
+	const char* T = strings[0].c_str();
+	int m = strings[0].size();
+
+	// The table, row by row, as the reference
+	vector <int> expected (S.size()), res (S.size());
+	double t0 = now();
+	for(size_t i = 0; i < S.size(); i++) expected[i] = lcsLength(S[i], n[i], T, m);
+	double t1 = now();
+	printf("%-8s %10.3lf s %8.3lf Gcells/s\n", "table", t1 - t0, 1e-9 * cells / (t1 - t0));
+
+	BitLCS bits;
+	for(int isa = SCALAR; isa <= detectIsa(); isa++) {
+		t0 = now();
+		bits.run(T, m, &S[0], &n[0], S.size(), &res[0], (Isa) isa);
+		t1 = now();
+		assert((res == expected) && "Bit-parallel lengths differ");
+		printf("%-8s %10.3lf s %8.3lf Gcells/s\n", isaNames[isa], t1 - t0, 1e-9 * cells / (t1 - t0));
+	}
+}
+
+/* ******************************************************************************************** */
+/// Runs the wavefront on two random strings with 1..maxThreads threads against the bit-parallel
+/// kernel on one thread
+void wavefrontBenchmark (int length, int maxThreads) {
+
+	string S, T;
+	for(int i = 0; i < length; i++) S += "ACGT"[rand() % 4], T += "ACGT"[rand() % 4];
+	double cells = ((double) length) * length;
+
+	double t0 = now();
+	int expected = lcsBits(S.c_str(), length, T.c_str(), length);
+	double base = now() - t0;
+	printf("%d x %d, lcs %d\n%8s %10s %10s %8s\n", length, length, expected, "#threads", "s",
+		"Gcells/s", "speedup");
+	printf("%8s %10.3lf %10.3lf %8s\n", "bits", base, 1e-9 * cells / base, "");
+	for(int t = 1; t <= maxThreads; t++) {
+		t0 = now();
+		int res = lcsWavefront(S.c_str(), length, T.c_str(), length, t);
+		double time = now() - t0;
+		assert((res == expected) && "Wavefront length differs");
+		printf("%8d %10.3lf %10.3lf %8.2lf\n", t, time, 1e-9 * cells / time, base / time);
+	}
+}
+
+/* ******************************************************************************************** */
+string readFile (const char* fileName) {
+	ifstream file (fileName, ios::binary);
+	assert(file.is_open() && "Could not open the file");
+	return string(istreambuf_iterator <char> (file), istreambuf_iterator <char> ());
+}
+
+/* ******************************************************************************************** */
+/// A pair of lines and their similarity
+struct Pair {
+	int a, b;
+	double sim;
+	bool operator< (const Pair& o) const { return (a < o.a) || ((a == o.a) && (b < o.b)); }
+};
+
+/* ******************************************************************************************** */
+/// The similarity of all the pairs of lines of a file, lcs(a, b) / max(|a|, |b|), which is 1 only
+/// for equal lines. The threads take the lines in order and run each against the lines after it
+/// in batches of SIMD lanes, each thread with its own buffers. With a threshold (>= 0), the pairs
+/// whose lengths alone rule it out are skipped, the others stop once it cannot be reached, and
+/// only the pairs at or above it are printed; otherwise the whole matrix is.
+void allPairs (const char* fileName, int numThreads, double threshold) {
+
+	// Read the lines
+	vector <string> lines;
+	ifstream file (fileName);
+	assert(file.is_open() && "Could not open the file");
+	for(string line; getline(file, line); ) lines.push_back(line);
+	int k = lines.size();
+	Isa isa = detectIsa();
+	bool matrix = (threshold < 0.0);
+
+	vector <float> sims (matrix ? (size_t) k * k : 0, 1.0f);
+	vector <Pair> pairs;
+	mutex pairsLock;
+	atomic <int> next (0);
+	atomic <long> computed (0), skipped (0), stopped (0);
+	double t0 = now();
+	vector <thread> threads;
+	for(int t = 0; t < numThreads; t++) {
+		threads.push_back(thread([&] () {
+			BitLCS bits;
+			vector <const char*> S;
+			vector <int> n, need, out, other;
+			vector <Pair> found;
+			long numComputed = 0, numSkipped = 0, numStopped = 0;
+			for(int a; (a = next++) < k; ) {
+
+				// Collect the later lines that can still be similar enough
+				const string& T = lines[a];
+				S.clear(), n.clear(), need.clear(), other.clear();
+				for(int b = a + 1; b < k; b++) {
+					int lo = min(T.size(), lines[b].size()), hi = max(T.size(), lines[b].size());
+					int minLcs = matrix ? 0 : (int) ceil(threshold * hi);
+					if(minLcs > lo) { numSkipped++; continue; }
+					S.push_back(lines[b].c_str()), n.push_back(lines[b].size());
+					need.push_back(minLcs), other.push_back(b);
+				}
+				if(S.empty()) continue;
+
+				out.resize(S.size());
+				bits.run(T.c_str(), T.size(), &S[0], &n[0], S.size(), &out[0], isa, matrix ? NULL : &need[0]);
+				numComputed += S.size();
+				for(size_t i = 0; i < S.size(); i++) {
+					if(out[i] < 0) { numStopped++; continue; }
+					int hi = max((int) T.size(), n[i]), b = other[i];
+					double sim = (hi == 0) ? 1.0 : ((double) out[i]) / hi;
+					if(matrix) sims[(size_t) a * k + b] = sims[(size_t) b * k + a] = sim;
+					else if(sim >= threshold) {
+						Pair p = {a, b, sim};
+						found.push_back(p);
+					}
+				}
+			}
+			lock_guard <mutex> lock (pairsLock);
+			pairs.insert(pairs.end(), found.begin(), found.end());
+			computed += numComputed, skipped += numSkipped, stopped += numStopped;
+		}));
+	}
+	for(int t = 0; t < numThreads; t++) threads[t].join();
+	double time = now() - t0;
+
+	// Print the matrix or the pairs in order
+	if(matrix) {
+		for(int a = 0; a < k; a++) {
+			for(int b = 0; b < k; b++) printf("%.3f%c", sims[(size_t) a * k + b], (b == k - 1) ? '\n' : ' ');
+		}
+	}
+	else {
+		sort(pairs.begin(), pairs.end());
+		for(size_t i = 0; i < pairs.size(); i++) printf("%d %d %.4lf\n", pairs[i].a, pairs[i].b, pairs[i].sim);
+	}
+	fprintf(stderr, "%d lines, %s, %d threads: %ld pairs computed (%ld stopped early), %ld skipped by "
+		"length, %.3lf s\n", k, isaNames[isa], numThreads, computed.load(), stopped.load(), skipped.load(), time);
+}
+
 /* ******************************************************************************************** */
 int main (int argc, char* argv[] ) {
+
+	// Long inputs from files, in linear space
+	if((argc > 3) && (strcmp(argv[1], "-f") == 0)) {
+		string S = readFile(argv[2]), T = readFile(argv[3]);
+		int res = lcsBits(S.c_str(), S.size(), T.c_str(), T.size());
+		string sub = hirschberg(S.c_str(), S.size(), T.c_str(), T.size());
+		assert((int) sub.size() == res);
+		printf("res: %d, sub: %s\n", res, sub.c_str());
+		return 0;
+	}
+
+	if((argc > 3) && (strcmp(argv[1], "-b") == 0)) {
+		benchmark(atoi(argv[2]), atoi(argv[3]));
+		return 0;
+	}
+	if((argc > 3) && (strcmp(argv[1], "-p") == 0)) {
+		allPairs(argv[2], atoi(argv[3]), (argc > 4) ? atof(argv[4]) : -1.0);
+		return 0;
+	}
+	if((argc > 3) && (strcmp(argv[1], "-w") == 0)) {
+		wavefrontBenchmark(atoi(argv[2]), atoi(argv[3]));
+		return 0;
+	}
+
 	assert(argc > 2 && "Need string arguments for subsequence");
 	N = strlen(argv[1]), M = strlen(argv[2]);
 	memory = new int [N * M];
@@ -1,8 +1,12 @@
-/** 
+/**
  * @file em.cpp
  * @author Can Erdogan
  * @date 2015-08-10
  * @brief Implementation of expectation-maximization to estimate gaussian mixtures for 2D data.
+ * The points are kept as one array per coordinate and the E-step works in log space over all of
+ * them at once, so that it vectorizes and far away points do not underflow.
+ * Usage: ./a.out                (fits 3 Gaussians to data2.txt with random restarts)
+ *        ./a.out -b <#points>   (E-step benchmark against the density of each point, on samples)
  */
 
 #include <assert.h>
@@ -15,6 +19,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/time.h>
 #include <vector>
 #include <Eigen/Dense>
 
@@ -24,22 +29,30 @@ using namespace Eigen;
 struct Gaussian {
 	Vector2d mean;
 	Matrix2d cov;
-	double mixCoeff; 
+	double mixCoeff;
+	double l11, l21, l22;				///< The Cholesky factor L of the covariance, cov = L L^T
+	double logNorm;							///< log(mixCoeff / (2 pi sqrt(det(cov)))), -inf if cov is singular
 	double prob (const Vector2d& p);
+	void factor ();
 };
 
 Gaussian Gs [3];
 Gaussian bestGs [3];
-vector <Vector2d> data;
-vector <Vector3d> weights;		/// Organized as (Ga_0, Gb_0, Gc_0), (Ga_1, Gb_1, Gc_1) ...
+ArrayXd xs, ys;								///< The data points, one array per coordinate
+ArrayXXd weights;							///< Organized as a column per Gaussian: weights(i, j) for point i
+ArrayXXd logProbs;						///< log(mixCoeff_j * N(p_i | mean_j, cov_j)) in the same layout
+ArrayXd logSums;							///< log of the sum of the probabilities of each point
 
 /* ******************************************************************************************** */
 void readData () {
 	ifstream infile("data2.txt");
 	double a, b;
-	while (infile >> a >> b) 
-		data.push_back(Eigen::Vector2d(a,b));
+	vector <double> as, bs;
+	while (infile >> a >> b)
+		as.push_back(a), bs.push_back(b);
 	infile.close();
+	xs = Map <ArrayXd> (&as[0], as.size());
+	ys = Map <ArrayXd> (&bs[0], bs.size());
 }
 
 /* ******************************************************************************************** */
@@ -47,13 +60,13 @@ void readData () {
 double Gaussian::prob (const Vector2d& p) {
 	static bool const dbg = 0;
 	if(dbg) printf("\n%s ---------------------\n", __FUNCTION__);
-	double norm_ = 1.0 / 2*M_PI*sqrt(cov.determinant());
+	double norm_ = 1.0 / (2*M_PI*sqrt(cov.determinant()));
 	if(dbg) cout << "cov: " << cov << endl;
 	if(dbg) cout << "cov inv: " << cov.inverse() << endl;
 	if(dbg) cout << "p: " << p.transpose() << ", mean: " << mean.transpose() << endl;
-	VectorXd val = (p - mean).transpose() * cov.inverse() * (p - mean);
-	if(dbg) printf("exp^(): %lf\n", val(0));
-	double exp_ = exp(-0.5 * val(0));
+	double val = (p - mean).transpose() * cov.inverse() * (p - mean);
+	if(dbg) printf("exp^(): %lf\n", val);
+	double exp_ = exp(-0.5 * val);
 	if(dbg) printf("%lf, %lf\n", norm_, exp_);
 	double p_ = norm_ * exp_;
 	if(p_ != p_) return 0.0;
@@ -61,28 +74,47 @@ double Gaussian::prob (const Vector2d& p) {
 }
 
 /* ******************************************************************************************** */
-/// Set an assignment score for each data point 
-void expectation () {
+/// Computes the Cholesky factor and the log normalizer, once per iteration instead of per point
+void Gaussian::factor () {
+	l11 = sqrt(cov(0,0));
+	l21 = cov(1,0) / l11;
+	l22 = sqrt(cov(1,1) - l21 * l21);
+	bool positive = (l11 > 0) && (l22 > 0);
+	logNorm = positive ? (log(mixCoeff) - log(2*M_PI) - log(l11) - log(l22)) : -INFINITY;
+}
+
+/* ******************************************************************************************** */
+/// Set an assignment score for each data point: the log probabilities of each Gaussian for all
+/// the points, with the quadratic form as |L^-1 (p - mean)|^2 by forward substitution, and then
+/// the weights normalized with log-sum-exp. Returns the log likelihood of the data.
+double expectation () {
 
 	static bool const dbg = 0;
 	if(dbg) printf("\n%s ---------------------\n", __FUNCTION__);
 
-	for(int i = 0; i < data.size(); i++) {
-
-		// Compute the probabilities for each Gaussian
-		Vector2d& p = data[i];
-		double probs [3];
-		double sum = 0.0;
-		for(int j = 0; j < 3; j++) {
-			probs[j] = Gs[j].mixCoeff * Gs[j].prob(p);
-			if(dbg) printf("probs[%d]: %lf\n", j, probs[j]);
-			sum += probs[j];
+	int n = xs.size();
+	logProbs.resize(n, 3);
+	for(int j = 0; j < 3; j++) {
+		Gaussian& g = Gs[j];
+		g.factor();
+		if(dbg) printf("L: %lf, %lf, %lf, log norm: %lf\n", g.l11, g.l21, g.l22, g.logNorm);
+		if(g.logNorm == -INFINITY) {
+			logProbs.col(j).setConstant(-INFINITY);
+			continue;
 		}
-
-		if(dbg) cout << "sum: " << sum << endl;
-		// Compute the new weights for each gaussian
-		for(int j = 0; j < 3; j++) weights[i](j) = probs[j] / sum;
+		double a = 1.0 / g.l11, b = g.l21 / (g.l11 * g.l22), c = 1.0 / g.l22;
+		logProbs.col(j) = g.logNorm - 0.5 * ((a * (xs - g.mean(0))).square() +
+			(c * (ys - g.mean(1)) - b * (xs - g.mean(0))).square());
 	}
+
+	// Shift by the largest term of each point so that the exponentials can not all underflow
+	ArrayXd maxs = logProbs.rowwise().maxCoeff();
+	weights = (logProbs.colwise() - maxs).exp();
+	logSums = weights.rowwise().sum();
+	weights.colwise() /= logSums;
+	logSums = maxs + logSums.log();
+	if(dbg) cout << "log likelihood: " << logSums.sum() << endl;
+	return logSums.sum();
 }
 
 /* ******************************************************************************************** */
@@ -96,13 +128,8 @@ void maximization () {
 	for(int j = 0; j < 3; j++) {
 
 		// Compute the sum of the weights and the weighted mean
-		double sum = 0.0; 
-		Vector2d weightedMean (0, 0);
-		for(int i = 0; i < data.size(); i++) {
-			sum += weights[i](j);
-			weightedMean += weights[i](j) * data[i];
-			if(dbg) printf("\t%lf\n", weights[i](j));
-		}
+		double sum = weights.col(j).sum();
+		Vector2d weightedMean ((weights.col(j) * xs).sum(), (weights.col(j) * ys).sum());
 		if(dbg) printf("sum: %lf, wM: (%lf, %lf)\n", sum, weightedMean(0), weightedMean(1));
 
 		// Set the new mean
@@ -110,48 +137,35 @@ void maximization () {
 		if(dbg) cout << "mean: " << Gs[j].mean.transpose() << endl;
 
 		// Compute the new covariance based on the new mean
-		Matrix2d newCov = Matrix2d::Zero();
-		for(int i = 0; i < data.size(); i++) 
-			newCov += (weights[i](j) * (data[i] - Gs[j].mean) * (data[i] - Gs[j].mean).transpose());
+		double mx = Gs[j].mean(0), my = Gs[j].mean(1);
+		Matrix2d newCov;
+		newCov(0,0) = (weights.col(j) * (xs - mx).square()).sum();
+		newCov(0,1) = newCov(1,0) = (weights.col(j) * (xs - mx) * (ys - my)).sum();
+		newCov(1,1) = (weights.col(j) * (ys - my).square()).sum();
 		if(dbg) cout << "newCov: " << newCov << endl;
 		Gs[j].cov = newCov / sum;
 
 		// Set the mixing coefficient
-		Gs[j].mixCoeff = sum / data.size();
+		Gs[j].mixCoeff = sum / xs.size();
 	}
-	
-	
-}
 
-/* ******************************************************************************************** */
-/// Evaluate the likelihood of the data generated from the modeled mixture of Gaussians
-double modelLikelihood () {
-	double logProb = 0.0;
-	//printf("weights:{\n");
-	for(int i = 0; i < data.size(); i++) {
-		double prob = 0.0;
-		for(int j = 0; j < 3; j++) 
-			prob += Gs[j].mixCoeff * Gs[j].prob(data[i]);
-		logProb += log(prob);
-//		printf("%lf, %lf, %lf\n", weights[i](0), weights[i](1), weights[i](2));
-	}
-//	printf("}\n\n");
-	return logProb;
+
 }
- 
+
 /* ******************************************************************************************** */
-/// The algorithm...
+/// The algorithm... Returns the log likelihood of the data under the final mixture, which the
+/// E-step computes along the way, or -inf if the mixture degenerates.
 double em () {
-	double lastLike = 0.0;
+	double lastLike = expectation();
 	for(int i = 0; i < 20; i++) {
-		expectation();
 		maximization();
-		double like = modelLikelihood();
-		if(like != like) return 100;
+		double like = expectation();
+		if(like != like) return -INFINITY;
 		if(fabs(like - lastLike) < 1e-4) return like;
 		lastLike = like;
 		// getchar();
 	}
+	return lastLike;
 }
 
 /* ******************************************************************************************** */
@@ -169,24 +183,94 @@ void init () {
 	// Gs[0].mean = Vector2d(2,2);
 	// Gs[1].mean = Vector2d(5,8);
 	// Gs[2].mean = Vector2d(8,5);
+}
+
+/* ******************************************************************************************** */
+double now () {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
 
-	// Weights..
-	weights = vector <Vector3d> (data.size(), Vector3d(1.0/3,1.0/3,1.0/3));
-//	for(int i = 0; i < data.size(); i++) 
-//		weights.push_back(Vector3d(1.0/3,1.0/3,1.0/3));
+/* ******************************************************************************************** */
+/// The E-step with the density of each point for each Gaussian, as a reference. Returns the
+/// number of points whose probabilities all underflow (their weights are 0/0).
+int directExpectation (ArrayXXd& out) {
+	int n = xs.size(), lost = 0;
+	out.resize(n, 3);
+	for(int i = 0; i < n; i++) {
+		Vector2d p (xs(i), ys(i));
+		double probs [3], sum = 0.0;
+		for(int j = 0; j < 3; j++) {
+			probs[j] = Gs[j].mixCoeff * Gs[j].prob(p);
+			sum += probs[j];
+		}
+		for(int j = 0; j < 3; j++) out(i, j) = probs[j] / sum;
+		lost += (sum == 0.0);
+	}
+	return lost;
 }
 
 /* ******************************************************************************************** */
-int main () {
+/// Samples points from the mixture of the result file and times both E-steps with a fresh
+/// initialization; then moves the Gaussians far away to compare the points lost to underflow
+void benchmark (int n) {
+
+	// Sample the points with Box-Muller
+	double means [3][2] = {{1.89, 3.94}, {4.69, 8.32}, {8.11, 3.85}};
+	Matrix2d covs [3];
+	covs[0] << 0.75, -1.21, -1.21, 2.87;
+	covs[1] << 0.30, -0.07, -0.07, 0.37;
+	covs[2] << 0.88, 0.94, 0.94, 1.93;
+	xs.resize(n), ys.resize(n);
+	for(int i = 0; i < n; i++) {
+		int j = rand() % 3;
+		double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = (rand() + 1.0) / (RAND_MAX + 2.0);
+		Vector2d z (sqrt(-2 * log(u)) * cos(2 * M_PI * v), sqrt(-2 * log(u)) * sin(2 * M_PI * v));
+		Vector2d p = Vector2d(means[j][0], means[j][1]) + covs[j].llt().matrixL() * z;
+		xs(i) = p(0), ys(i) = p(1);
+	}
+
+	init();
+	for(int trial = 0; trial < 2; trial++) {
+		ArrayXXd direct;
+		double t0 = now();
+		int lost = directExpectation(direct);
+		double t1 = now();
+		double like = expectation();
+		double t2 = now();
+		expectation();
+		double t3 = now();
+		double diff = (lost == n) ? NAN : (direct - weights).abs().maxCoeff();
+		printf("%s: direct %.1lf ns/point (%d points lost), log space %.1lf ns/point (%.1lf when the "
+			"arrays are allocated), log likelihood %.1lf, max weight difference %.2e\n",
+			(trial == 0) ? "random init" : "far away", 1e9 * (t1 - t0) / n, lost, 1e9 * (t3 - t2) / n,
+			1e9 * (t2 - t1) / n, like, diff);
+		for(int j = 0; j < 3; j++) Gs[j].mean += Vector2d(100.0, 100.0), Gs[j].cov *= 0.5;
+	}
+
+	// A whole fit
+	init();
+	double t0 = now();
+	double like = em();
+	printf("em: %.3lf s, log likelihood %.1lf\n", now() - t0, like);
+}
+
+/* ******************************************************************************************** */
+int main (int argc, char* argv[]) {
 	srand(time(NULL));
+	if((argc > 2) && (strcmp(argv[1], "-b") == 0)) {
+		benchmark(atoi(argv[2]));
+		return 0;
+	}
 	readData();
-	double minLike = 100.0;
+	double maxLike = -INFINITY;
 	for(int i = 0; i < 1000; i++) {
 		init();
 		double val = em();
-		// printf("min: %lf\n", val);
-		if(val < minLike) {
-			minLike = val;
+		// printf("max: %lf\n", val);
+		if(val > maxLike) {
+			maxLike = val;
 			for(int i = 0; i < 3; i++) bestGs[i] = Gs[i];
 		}
 	}
@@ -194,6 +278,6 @@ int main () {
 		cout << bestGs[i].mean.transpose() << endl;
 		cout << bestGs[i].cov << endl;
 	}
-	
+
 }
 /* ******************************************************************************************** */
@@ -153,7 +153,9 @@ struct TreeNode {
 };
 
 /* ----------------------------------------------------------------------------------- */
-bool compare (TreeNode* x, TreeNode* y) { return x->value() < y->value(); }
+struct Compare {
+	bool operator() (TreeNode* x, TreeNode* y) const { return x->value() < y->value(); }
+};
 
 /* ----------------------------------------------------------------------------------- */
 string print (TreeNode* x) { 
@@ -164,7 +166,9 @@ string print (TreeNode* x) {
 	return string(buf);
 }
 
-AVL <TreeNode*> avl (compare, print);
+/// Not rebalanced: the arcs are read from the leaves (traversal_leaves), which rotations move
+typedef AVL <TreeNode*, Compare, false> BeachLine;
+BeachLine avl (Compare(), print);
 
 /* ******************************************************************************************** */
 void readData () {
@@ -233,7 +237,7 @@ void vd () {
 			getchar2();
 
 			// Locate the existing arc information
-			pair <bool, AVL<TreeNode*>::Node*> searchRes = 
+			pair <bool, BeachLine::Node*> searchRes = 
 				avl.search_candidateLoc(new TreeNode(siteEvent->pi, -1, true));
 
 			// The tree is empty. Temporarily add the site information as a dummy node
@@ -280,7 +284,7 @@ void vd () {
 			}
 			
 			// Get the leaf information to check for circles
-			vector <pair<int, AVL<TreeNode*>::Node*> > leafParents;
+			vector <pair<int, BeachLine::Node*> > leafParents;
 			avl.traversal_leaves(leafParents);
 			printf("Traversal: {");
 			vector <pair<int, TreeNode*> > sites;
@@ -365,16 +369,16 @@ void vd () {
 			}
 
 			// Get the arc that is disappearing due to the circle
-			pair <bool, AVL<TreeNode*>::Node*> searchRes = 
+			pair <bool, BeachLine::Node*> searchRes = 
 				avl.search_candidateLoc(new TreeNode(ce->point, Vector2d(), true));
 			assert(searchRes.second != NULL && "Could not find the above arc");
 			TreeNode* node1 = searchRes.second->value;
-			AVL<TreeNode*>::Node* searchNode = searchRes.second;
+			BeachLine::Node* searchNode = searchRes.second;
 			printf("node1: (%d,%d)\n", node1->p0i, node1->p1i);
 
 			// Fix node1 if next one is better
-			AVL<TreeNode*>::Node* temp = avl.next(searchNode);
-			AVL<TreeNode*>::Node* temp2 = avl.prev(searchNode);
+			BeachLine::Node* temp = avl.next(searchNode);
+			BeachLine::Node* temp2 = avl.prev(searchNode);
 			if(temp != NULL) printf("temp: '%s'\n", print(temp->value).c_str());
 			if(temp != NULL) printf("temp2: '%s'\n", print(temp2->value).c_str());
 			double diff1 = (node1->value() - ce->point(0));
@@ -402,9 +406,9 @@ void vd () {
 			}
 
 			// Determine the other node
-			AVL<TreeNode*>::Node* opt1 = avl.next(searchNode);
+			BeachLine::Node* opt1 = avl.next(searchNode);
 			if(opt1 != NULL) printf("opt1: '%s'\n", print(opt1->value).c_str());
-			AVL<TreeNode*>::Node* opt2 = avl.prev(searchNode);
+			BeachLine::Node* opt2 = avl.prev(searchNode);
 			if(opt2 != NULL) printf("opt2: '%s'\n", print(opt2->value).c_str());
 			TreeNode* node2;
 			if(opt1 == NULL) node2 = opt2->value;
@@ -511,7 +515,7 @@ void vd () {
 			}
 
 			// Get the leaf information to check for circles again
-			vector <pair<int, AVL<TreeNode*>::Node*> > leafParents;
+			vector <pair<int, BeachLine::Node*> > leafParents;
 			avl.traversal_leaves(leafParents);
 			printf("Traversal: {");
 			vector <pair<int, TreeNode*> > sites;
@@ -591,7 +595,7 @@ void termination () {
 
 	
 	sweepLine -= 3.0;
-	vector <AVL<TreeNode*>::Node*> nodes;
+	vector <BeachLine::Node*> nodes;
 	avl.traversal(nodes);
 	for(int i = 0; i < nodes.size(); i++) {
 		printf("awef\n");